@@ -0,0 +1,811 @@
+/*
+ *  ForkLoader.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ForkLoader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(STATX_SIZE)
+#define HAVE_IO_URING 1
+#endif
+
+using namespace IIgs;
+
+
+namespace {
+
+    struct Job {
+        unsigned index;
+        uint8_t *data;
+        unsigned length;
+        int error;
+    };
+
+
+    /*
+     * bounded queue between the readers and the parsers.
+     */
+    class JobQueue {
+
+    public:
+
+        JobQueue(unsigned capacity) : _capacity(capacity), _closed(false)
+        {
+            pthread_mutex_init(&_lock, NULL);
+            pthread_cond_init(&_notEmpty, NULL);
+            pthread_cond_init(&_notFull, NULL);
+        }
+
+        ~JobQueue()
+        {
+            pthread_cond_destroy(&_notFull);
+            pthread_cond_destroy(&_notEmpty);
+            pthread_mutex_destroy(&_lock);
+        }
+
+        void push(const Job& job)
+        {
+            pthread_mutex_lock(&_lock);
+            while (_jobs.size() >= _capacity)
+                pthread_cond_wait(&_notFull, &_lock);
+
+            _jobs.push_back(job);
+            pthread_cond_signal(&_notEmpty);
+            pthread_mutex_unlock(&_lock);
+        }
+
+        bool pop(Job& job)
+        {
+            pthread_mutex_lock(&_lock);
+            while (_jobs.empty() && !_closed)
+                pthread_cond_wait(&_notEmpty, &_lock);
+
+            if (_jobs.empty())
+            {
+                pthread_mutex_unlock(&_lock);
+                return false;
+            }
+
+            job = _jobs.front();
+            _jobs.pop_front();
+            pthread_cond_signal(&_notFull);
+            pthread_mutex_unlock(&_lock);
+            return true;
+        }
+
+        void close()
+        {
+            pthread_mutex_lock(&_lock);
+            _closed = true;
+            pthread_cond_broadcast(&_notEmpty);
+            pthread_mutex_unlock(&_lock);
+        }
+
+    private:
+
+        std::deque<Job> _jobs;
+        unsigned _capacity;
+        bool _closed;
+
+        pthread_mutex_t _lock;
+        pthread_cond_t _notEmpty;
+        pthread_cond_t _notFull;
+    };
+
+
+#ifdef HAVE_IO_URING
+
+    /*
+     * Minimal io_uring wrapper (no liburing dependency).
+     * Single producer / single consumer -- only used from the run() thread.
+     */
+    class Ring {
+
+    public:
+
+        Ring() : _fd(-1), _sq(MAP_FAILED), _cq(MAP_FAILED), _sqes((io_uring_sqe *)MAP_FAILED), _queued(0), _pending(0)
+        {}
+
+        ~Ring()
+        {
+            if (_sqes != MAP_FAILED) munmap(_sqes, _sqesSize);
+            if (_cq != MAP_FAILED && _cq != _sq) munmap(_cq, _cqSize);
+            if (_sq != MAP_FAILED) munmap(_sq, _sqSize);
+            if (_fd >= 0) ::close(_fd);
+        }
+
+        bool init(unsigned entries)
+        {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+
+            _fd = syscall(__NR_io_uring_setup, entries, &p);
+            if (_fd < 0) return false;
+
+            _sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                if (_cqSize > _sqSize) _sqSize = _cqSize;
+                _cqSize = _sqSize;
+            }
+
+            _sq = mmap(NULL, _sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            if (_sq == MAP_FAILED) return false;
+
+            if (p.features & IORING_FEAT_SINGLE_MMAP) _cq = _sq;
+            else
+            {
+                _cq = mmap(NULL, _cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+                if (_cq == MAP_FAILED) return false;
+            }
+
+            _sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+            _sqes = (io_uring_sqe *)mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+            if (_sqes == MAP_FAILED) return false;
+
+            uint8_t *sq = (uint8_t *)_sq;
+            uint8_t *cq = (uint8_t *)_cq;
+
+            _sqHead = (unsigned *)(sq + p.sq_off.head);
+            _sqTail = (unsigned *)(sq + p.sq_off.tail);
+            _sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+            _sqEntries = p.sq_entries;
+            _sqArray = (unsigned *)(sq + p.sq_off.array);
+
+            _cqHead = (unsigned *)(cq + p.cq_off.head);
+            _cqTail = (unsigned *)(cq + p.cq_off.tail);
+            _cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+            _cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+            return true;
+        }
+
+        bool supports(const unsigned *ops, unsigned count)
+        {
+            const unsigned size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+            uint8_t buffer[size];
+            std::memset(buffer, 0, size);
+
+            io_uring_probe *probe = (io_uring_probe *)buffer;
+
+            if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+                return false;
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                if (ops[i] > probe->last_op) return false;
+                if (!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) return false;
+            }
+            return true;
+        }
+
+        // the entry isn't visible to the kernel until submit().
+        io_uring_sqe *sqe()
+        {
+            unsigned tail = *_sqTail + _queued;
+            unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+
+            if (tail - head >= _sqEntries) return NULL;
+
+            unsigned index = tail & _sqMask;
+            io_uring_sqe *sqe = _sqes + index;
+
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            _sqArray[index] = index;
+
+            ++_queued;
+            return sqe;
+        }
+
+        // submit queued entries and wait for at least one completion.
+        int submit()
+        {
+            if (_queued)
+            {
+                __atomic_store_n(_sqTail, *_sqTail + _queued, __ATOMIC_RELEASE);
+                _pending += _queued;
+                _queued = 0;
+            }
+
+            for(;;)
+            {
+                int rv = syscall(__NR_io_uring_enter, _fd, _pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                if (rv >= 0)
+                {
+                    _pending -= rv;
+                    return rv;
+                }
+                if (errno != EINTR) return -errno;
+            }
+        }
+
+        bool cqe(io_uring_cqe *out)
+        {
+            unsigned head = *_cqHead;
+            unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+            if (head == tail) return false;
+
+            *out = _cqes[head & _cqMask];
+            __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+    private:
+
+        int _fd;
+
+        void *_sq;
+        size_t _sqSize;
+        void *_cq;
+        size_t _cqSize;
+        io_uring_sqe *_sqes;
+        size_t _sqesSize;
+
+        unsigned *_sqHead;
+        unsigned *_sqTail;
+        unsigned *_sqArray;
+        unsigned _sqMask;
+        unsigned _sqEntries;
+
+        unsigned *_cqHead;
+        unsigned *_cqTail;
+        unsigned _cqMask;
+        io_uring_cqe *_cqes;
+
+        unsigned _queued;
+        unsigned _pending;
+    };
+
+
+    enum {
+        sXattrSize,
+        sXattrRead,
+        sStatx,
+        sOpen,
+        sHeader,
+        sRead
+    };
+
+    struct Request {
+        unsigned index;
+        unsigned state;
+        int fd;
+        uint8_t *data;
+        unsigned size;
+        unsigned offset;    // file offset of the fork
+        uint64_t fileSize;
+        unsigned done;
+        std::string adPath;
+        struct statx stx;
+        uint8_t header[26 + 12 * 10];
+    };
+
+#endif
+
+} // namespace
+
+
+namespace IIgs {
+
+    class ForkLoaderImpl {
+
+    public:
+
+        ForkLoaderImpl(ForkLoader& loader, ForkLoader::Callback callback, void *context) :
+            _loader(loader), _callback(callback), _context(context),
+            _queue(loader._queueDepth * 2), _next(0), _loaded(0)
+        {
+            pthread_mutex_init(&_lock, NULL);
+        }
+
+        ~ForkLoaderImpl()
+        {
+            pthread_mutex_destroy(&_lock);
+        }
+
+        unsigned run();
+
+    private:
+
+        static void *Worker(void *arg);
+        static void *Reader(void *arg);
+
+        void work();
+        void read();
+        void process(const Job& job);
+        void finish(unsigned index, uint8_t *data, unsigned length, int error);
+
+        void readThreads();
+#ifdef HAVE_IO_URING
+        bool readUring();
+        void start(Ring& ring, Request *r);
+        bool complete(Ring& ring, Request *r, int res);
+        bool prepareRead(Ring& ring, Request *r);
+#endif
+
+        ForkLoader& _loader;
+        ForkLoader::Callback _callback;
+        void *_context;
+
+        JobQueue _queue;
+
+        pthread_mutex_t _lock;
+        unsigned _next;
+        unsigned _loaded;
+    };
+
+
+    void *ForkLoaderImpl::Worker(void *arg)
+    {
+        ((ForkLoaderImpl *)arg)->work();
+        return NULL;
+    }
+
+    void *ForkLoaderImpl::Reader(void *arg)
+    {
+        ((ForkLoaderImpl *)arg)->read();
+        return NULL;
+    }
+
+
+    void ForkLoaderImpl::process(const Job& job)
+    {
+        const char *path = _loader._paths[job.index].c_str();
+
+        if (!job.data)
+        {
+            _callback(path, NULL, job.error, _context);
+            return;
+        }
+
+        ResourceManager rm(job.data, job.length, rmDelete);
+        _callback(path, &rm, 0, _context);
+    }
+
+    void ForkLoaderImpl::work()
+    {
+        Job job;
+        while (_queue.pop(job)) process(job);
+    }
+
+    void ForkLoaderImpl::finish(unsigned index, uint8_t *data, unsigned length, int error)
+    {
+        Job job;
+        job.index = index;
+        job.data = data;
+        job.length = length;
+        job.error = error;
+
+        if (data) __sync_fetch_and_add(&_loaded, 1);
+
+        _queue.push(job);
+    }
+
+
+    unsigned ForkLoaderImpl::run()
+    {
+        std::vector<pthread_t> workers(_loader._workers);
+        unsigned count = 0;
+
+        for (unsigned i = 0; i < workers.size(); ++i)
+        {
+            if (pthread_create(&workers[count], NULL, Worker, this) == 0) ++count;
+        }
+
+        if (count == 0)
+        {
+            // no threads -- read and parse one at a time.
+            unsigned options = _loader._options & (rfRaw | rfAppleDouble);
+
+            for (unsigned i = 0; i < _loader._paths.size(); ++i)
+            {
+                Job job;
+                job.index = i;
+                job.data = ReadResourceFork(_loader._paths[i].c_str(), &job.length, options);
+                job.error = job.data ? 0 : errno;
+
+                if (job.data) ++_loaded;
+                process(job);
+            }
+            return _loaded;
+        }
+
+        _loader._usedUring = false;
+
+#ifdef HAVE_IO_URING
+        if (!(_loader._options & flNoUring))
+            _loader._usedUring = readUring();
+#endif
+
+        if (!_loader._usedUring) readThreads();
+
+        _queue.close();
+
+        for (unsigned i = 0; i < count; ++i)
+            pthread_join(workers[i], NULL);
+
+        return _loaded;
+    }
+
+
+#pragma mark Thread pool
+
+    void ForkLoaderImpl::read()
+    {
+        unsigned options = _loader._options & (rfRaw | rfAppleDouble);
+        unsigned count = _loader._paths.size();
+
+        for(;;)
+        {
+            pthread_mutex_lock(&_lock);
+            unsigned index = _next++;
+            pthread_mutex_unlock(&_lock);
+
+            if (index >= count) break;
+
+            unsigned length;
+            uint8_t *data = ReadResourceFork(_loader._paths[index].c_str(), &length, options);
+
+            finish(index, data, length, data ? 0 : errno);
+        }
+    }
+
+    void ForkLoaderImpl::readThreads()
+    {
+        // one blocking read per thread, so the thread count is the queue depth.
+        unsigned depth = _loader._queueDepth;
+        if (depth > _loader._paths.size()) depth = _loader._paths.size();
+
+        std::vector<pthread_t> readers(depth);
+        unsigned count = 0;
+
+        for (unsigned i = 0; i < depth; ++i)
+        {
+            if (pthread_create(&readers[count], NULL, Reader, this) == 0) ++count;
+        }
+
+        // couldn't start any threads, so do it here.
+        if (count == 0) read();
+
+        for (unsigned i = 0; i < count; ++i)
+            pthread_join(readers[i], NULL);
+    }
+
+
+#ifdef HAVE_IO_URING
+
+#pragma mark io_uring
+
+    bool ForkLoaderImpl::readUring()
+    {
+        Ring ring;
+        unsigned depth = _loader._queueDepth;
+        unsigned options = _loader._options;
+        unsigned count = _loader._paths.size();
+
+        if (!ring.init(depth)) return false;
+
+        unsigned ops[3];
+        unsigned opCount = 0;
+
+        if (options & rfRaw)
+        {
+            ops[opCount++] = IORING_OP_STATX;
+            ops[opCount++] = IORING_OP_OPENAT;
+            ops[opCount++] = IORING_OP_READ;
+        }
+        else if (options & rfAppleDouble)
+        {
+            ops[opCount++] = IORING_OP_STATX;
+            ops[opCount++] = IORING_OP_OPENAT;
+            ops[opCount++] = IORING_OP_READ;
+        }
+        else
+        {
+            ops[opCount++] = IORING_OP_GETXATTR;
+        }
+
+        if (!ring.supports(ops, opCount)) return false;
+
+
+        // each request has at most one sqe outstanding, so the ring never overflows.
+        std::vector<Request> requests(depth);
+        std::vector<Request *> free;
+
+        for (unsigned i = 0; i < depth; ++i)
+            free.push_back(&requests[i]);
+
+        unsigned inflight = 0;
+
+        while (_next < count || inflight)
+        {
+            while (_next < count && !free.empty())
+            {
+                Request *r = free.back();
+                free.pop_back();
+
+                r->index = _next++;
+                r->fd = -1;
+                r->data = NULL;
+                r->size = 0;
+                r->offset = 0;
+                r->fileSize = 0;
+                r->done = 0;
+
+                start(ring, r);
+                ++inflight;
+            }
+
+            if (!inflight) break;
+
+            int rv = ring.submit();
+            if (rv < 0 && rv != -EBUSY)
+            {
+                // the ring is broken; requests in flight can't be recovered.
+                // their buffers are leaked since the kernel may still write to them.
+                for (unsigned i = 0; i < depth; ++i)
+                {
+                    Request *r = &requests[i];
+                    if (std::find(free.begin(), free.end(), r) != free.end()) continue;
+                    finish(r->index, NULL, 0, -rv);
+                }
+                // finish the rest on the thread pool.
+                readThreads();
+                return true;
+            }
+
+            io_uring_cqe cqe;
+            while (ring.cqe(&cqe))
+            {
+                Request *r = (Request *)(uintptr_t)cqe.user_data;
+
+                if (!complete(ring, r, cqe.res))
+                {
+                    --inflight;
+                    free.push_back(r);
+                }
+            }
+        }
+
+        return true;
+    }
+
+
+    // queue the first operation for a request.
+    void ForkLoaderImpl::start(Ring& ring, Request *r)
+    {
+        const char *path = _loader._paths[r->index].c_str();
+        unsigned options = _loader._options;
+        io_uring_sqe *sqe = ring.sqe();
+
+        sqe->user_data = (uintptr_t)r;
+
+        if (options & rfRaw)
+        {
+            r->state = sStatx;
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uintptr_t)&r->stx;
+        }
+        else if (options & rfAppleDouble)
+        {
+            // the file size bounds the fork entry in the header.
+            r->adPath = AppleDoublePath(path);
+            r->state = sStatx;
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)r->adPath.c_str();
+            sqe->len = STATX_SIZE;
+            sqe->off = (uintptr_t)&r->stx;
+        }
+        else
+        {
+            r->state = sXattrSize;
+            sqe->opcode = IORING_OP_GETXATTR;
+            sqe->addr = (uintptr_t)ResourceForkXattr;
+            sqe->addr3 = (uintptr_t)path;
+            sqe->addr2 = 0;
+            sqe->len = 0;
+        }
+    }
+
+    bool ForkLoaderImpl::prepareRead(Ring& ring, Request *r)
+    {
+        io_uring_sqe *sqe = ring.sqe();
+
+        r->state = sRead;
+        sqe->user_data = (uintptr_t)r;
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = r->fd;
+        sqe->addr = (uintptr_t)(r->data + r->done);
+        sqe->len = r->size - r->done;
+        sqe->off = r->offset + r->done;
+
+        return true;
+    }
+
+    /*
+     * handle a completion.  returns true if another operation was queued,
+     * false if the request is finished.
+     */
+    bool ForkLoaderImpl::complete(Ring& ring, Request *r, int res)
+    {
+        int error = 0;
+
+        if (res < 0)
+        {
+            error = -res;
+            goto done;
+        }
+
+        switch (r->state)
+        {
+            case sXattrSize:
+            {
+                r->size = res;
+                r->data = new uint8_t[res ? res : 1];
+
+                io_uring_sqe *sqe = ring.sqe();
+                r->state = sXattrRead;
+                sqe->user_data = (uintptr_t)r;
+                sqe->opcode = IORING_OP_GETXATTR;
+                sqe->addr = (uintptr_t)ResourceForkXattr;
+                sqe->addr3 = (uintptr_t)_loader._paths[r->index].c_str();
+                sqe->addr2 = (uintptr_t)r->data;
+                sqe->len = r->size;
+                return true;
+            }
+
+            case sXattrRead:
+                // changed between the two calls.
+                if ((unsigned)res != r->size) error = EIO;
+                goto done;
+
+            case sStatx:
+            {
+                bool appleDouble = _loader._options & rfAppleDouble;
+
+                r->fileSize = r->stx.stx_size;
+                if (!appleDouble) r->size = r->stx.stx_size;
+
+                io_uring_sqe *sqe = ring.sqe();
+                r->state = sOpen;
+                sqe->user_data = (uintptr_t)r;
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uintptr_t)(appleDouble ? r->adPath.c_str() : _loader._paths[r->index].c_str());
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                return true;
+            }
+
+            case sOpen:
+                r->fd = res;
+
+                if (_loader._options & rfAppleDouble)
+                {
+                    io_uring_sqe *sqe = ring.sqe();
+                    r->state = sHeader;
+                    sqe->user_data = (uintptr_t)r;
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = r->fd;
+                    sqe->addr = (uintptr_t)r->header;
+                    sqe->len = sizeof(r->header);
+                    sqe->off = 0;
+                    return true;
+                }
+
+                r->data = new uint8_t[r->size ? r->size : 1];
+                if (r->size == 0) goto done;
+                return prepareRead(ring, r);
+
+            case sHeader:
+                if (!ParseAppleDouble(r->header, res, &r->offset, &r->size))
+                {
+                    error = ENOENT;
+                    goto done;
+                }
+
+                // a corrupt entry mustn't make us allocate more than the file holds.
+                if ((uint64_t)r->offset + r->size > r->fileSize)
+                {
+                    r->size = 0;
+                    error = EIO;
+                    goto done;
+                }
+
+                r->data = new uint8_t[r->size ? r->size : 1];
+                if (r->size == 0) goto done;
+                return prepareRead(ring, r);
+
+            case sRead:
+                if (res == 0)
+                {
+                    // truncated.
+                    error = EIO;
+                    goto done;
+                }
+
+                r->done += res;
+                if (r->done < r->size) return prepareRead(ring, r);
+                goto done;
+        }
+
+    done:
+        if (r->fd >= 0) ::close(r->fd);
+        r->fd = -1;
+
+        if (error)
+        {
+            delete[] r->data;
+            finish(r->index, NULL, 0, error);
+        }
+        else finish(r->index, r->data, r->size, 0);
+
+        r->data = NULL;
+        return false;
+    }
+
+#endif
+
+} // namespace
+
+
+    ForkLoader::ForkLoader(unsigned options, unsigned queueDepth, unsigned workers)
+    {
+        if (queueDepth == 0) queueDepth = 1;
+
+        if (workers == 0)
+        {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            workers = n > 0 ? n : 1;
+        }
+
+        _options = options;
+        _queueDepth = queueDepth;
+        _workers = workers;
+        _usedUring = false;
+    }
+
+    ForkLoader::~ForkLoader()
+    {
+    }
+
+    void ForkLoader::add(const char *path)
+    {
+        if (path) _paths.push_back(path);
+    }
+
+    void ForkLoader::add(const std::string& path)
+    {
+        _paths.push_back(path);
+    }
+
+    unsigned ForkLoader::run(Callback callback, void *context)
+    {
+        if (callback == NULL) return 0;
+
+        ForkLoaderImpl impl(*this, callback, context);
+        return impl.run();
+    }
@@ -0,0 +1,70 @@
+/*
+ *  ForkLoader.h
+ *  IIgsResource
+ *
+ *  Asynchronous resource fork loading for large batches of files.
+ *
+ */
+
+#ifndef __PRODOS_FORK_LOADER_H__
+#define __PRODOS_FORK_LOADER_H__
+
+#include "ResourceManager.h"
+#include "ResourceFork.h"
+
+#ifdef __cplusplus
+
+namespace IIgs {
+
+    enum {
+        // rfRaw / rfAppleDouble select the fork source (see ResourceFork.h)
+        flNoUring       = 0x100     // always use the thread pool
+    };
+
+
+    /*
+     * Reads forks with up to queueDepth I/Os in flight (io_uring on linux, otherwise
+     * a pool of blocking reader threads) and parses them on worker threads.
+     *
+     * The callback is called on a worker thread, once per path.  If the read failed,
+     * rm is NULL and error is the errno; otherwise check rm->error().  rm (and its data)
+     * is deleted when the callback returns.
+     */
+    class ForkLoader {
+
+    public:
+
+        typedef void (*Callback)(const char *path, ResourceManager *rm, int error, void *context);
+
+        ForkLoader(unsigned options = 0, unsigned queueDepth = 32, unsigned workers = 0);
+        ~ForkLoader();
+
+        void add(const char *path);
+        void add(const std::string& path);
+
+        // load everything added so far; blocks until every callback has returned.
+        // returns the number of forks that were read.
+        unsigned run(Callback callback, void *context);
+
+        // true if the last run() used io_uring.
+        bool usedUring() const { return _usedUring; }
+
+    private:
+
+        ForkLoader(const ForkLoader&);
+        ForkLoader& operator=(const ForkLoader&);
+
+        friend class ForkLoaderImpl;
+
+        std::vector<std::string> _paths;
+        unsigned _options;
+        unsigned _queueDepth;
+        unsigned _workers;
+        bool _usedUring;
+    };
+
+} // namespace
+
+#endif
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ *  OMF.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "OMF.h"
+
+#include <cstring>
+
+using namespace IIgs;
+
+
+
+    static inline unsigned read16(const uint8_t *x)
+    {
+        return x[0] | (x[1] << 8);
+    }
+
+    static inline unsigned read24(const uint8_t *x)
+    {
+        return x[0] | (x[1] << 8) | (x[2] << 16);
+    }
+
+    static inline unsigned read32(const uint8_t *x)
+    {
+        return x[0] | (x[1] << 8) | (x[2] << 16) | (x[3] << 24);
+    }
+
+    static inline void write(uint8_t *x, unsigned value, unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            x[i] = value & 0xff;
+            value >>= 8;
+        }
+    }
+
+
+    /*
+     * size of a relocation record, including the opcode.
+     * returns 0 if it's not a relocation record.
+     */
+    static unsigned RelocationSize(unsigned opcode)
+    {
+        switch (opcode)
+        {
+            case omfRELOC:
+                return 11;
+            case omfINTERSEG:
+                return 15;
+            case omfcRELOC:
+                return 7;
+            case omfcINTERSEG:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+
+
+
+    OMFSegment::OMFSegment(const uint8_t *data, unsigned length, unsigned options)
+    {
+        _data = data;
+        _length = length;
+        _options = options;
+        _dictionary = 0;
+        _decoded = false;
+        _error = 0;
+
+        std::memset(&_header, 0, sizeof(_header));
+
+        parse();
+    }
+
+    OMFSegment::OMFSegment(const std::pair<const uint8_t *, unsigned>& resource, unsigned options)
+    {
+        _data = resource.first;
+        _length = resource.second;
+        _options = options;
+        _dictionary = 0;
+        _decoded = false;
+        _error = 0;
+
+        std::memset(&_header, 0, sizeof(_header));
+
+        parse();
+    }
+
+
+    bool OMFSegment::isCodeResource(ResType resType)
+    {
+        switch (resType)
+        {
+            case rCodeResource:
+            case rCDEVCode:
+            case rXCMD:
+            case rXFCN:
+            case rCtlDefProc:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+
+    void OMFSegment::setError(unsigned error)
+    {
+        _error = error;
+        if (error && _options & rmThrow)
+        {
+            throw error;
+        }
+    }
+
+
+    std::string OMFSegment::segmentName() const
+    {
+        if (!_header.segName) return "";
+        return std::string((const char *)_header.segName, _header.segNameLength);
+    }
+
+    std::string OMFSegment::loadName() const
+    {
+        if (!_header.loadName) return "";
+
+        unsigned l = 10;
+        while (l && _header.loadName[l - 1] == ' ') --l;
+
+        return std::string((const char *)_header.loadName, l);
+    }
+
+
+    void OMFSegment::parse()
+    {
+        /*
+         * Segment Header (version 2):
+         *
+         * 0  uint32_t BYTECNT
+         * 4  uint32_t RESSPC
+         * 8  uint32_t LENGTH
+         * 12 uint8_t  (undefined)
+         * 13 uint8_t  LABLEN
+         * 14 uint8_t  NUMLEN (4)
+         * 15 uint8_t  VERSION (2)
+         * 16 uint32_t BANKSIZE
+         * 20 uint16_t KIND
+         * 22 uint16_t (undefined)
+         * 24 uint32_t ORG
+         * 28 uint32_t ALIGN
+         * 32 uint8_t  NUMSEX (0)
+         * 33 uint8_t  (undefined)
+         * 34 uint16_t SEGNUM
+         * 36 uint32_t ENTRY
+         * 40 uint16_t DISPNAME
+         * 42 uint16_t DISPDATA
+         */
+
+        if (_data == NULL || _length < 44)
+        {
+            setError(resBadFormat);
+            return;
+        }
+
+        const uint8_t *cp = _data;
+
+        _header.byteCount = read32(cp + 0);
+        _header.reserveSpace = read32(cp + 4);
+        _header.length = read32(cp + 8);
+        _header.labelLength = cp[13];
+        _header.numberLength = cp[14];
+        _header.version = cp[15];
+        _header.bankSize = read32(cp + 16);
+        _header.kind = read16(cp + 20);
+        _header.org = read32(cp + 24);
+        _header.align = read32(cp + 28);
+        _header.segNum = read16(cp + 34);
+        _header.entry = read32(cp + 36);
+        _header.dispName = read16(cp + 40);
+        _header.dispData = read16(cp + 42);
+
+        // only version 2 (and 2.1) load segments are supported.
+        if (_header.version != 2 || _header.numberLength != 4 || cp[32] != 0)
+        {
+            setError(resBadFormat);
+            return;
+        }
+
+        if (_header.byteCount > _length
+            || _header.dispName < 44
+            || _header.dispName + 10 > _header.dispData
+            || _header.dispData >= _header.byteCount)
+        {
+            setError(resBadFormat);
+            return;
+        }
+
+        // load name is 10 bytes, followed by the segment name.
+        unsigned offset = _header.dispName;
+
+        _header.loadName = _data + offset;
+        offset += 10;
+
+        if (_header.labelLength == 0)
+        {
+            _header.segNameLength = _data[offset];
+            offset += 1;
+        }
+        else _header.segNameLength = _header.labelLength;
+
+        if (offset + _header.segNameLength > _header.dispData)
+        {
+            setError(resBadFormat);
+            return;
+        }
+        _header.segName = _data + offset;
+
+
+        // scan the body.
+        unsigned end = _header.byteCount;
+        unsigned image = 0;
+
+        offset = _header.dispData;
+
+        for(;;)
+        {
+            if (offset >= end)
+            {
+                setError(resBadFormat);
+                return;
+            }
+
+            unsigned opcode = _data[offset];
+
+            if (opcode == omfEND) break;
+
+            if (opcode == omfLCONST || opcode == omfDS || opcode < omfALIGN)
+            {
+                unsigned count;
+                const uint8_t *data = NULL;
+
+                if (opcode < omfALIGN)
+                {
+                    count = opcode;
+                    offset += 1;
+                }
+                else
+                {
+                    if (offset + 5 > end)
+                    {
+                        setError(resBadFormat);
+                        return;
+                    }
+                    count = read32(_data + offset + 1);
+                    offset += 5;
+                }
+
+                if (opcode != omfDS)
+                {
+                    if (count > end - offset)
+                    {
+                        setError(resBadFormat);
+                        return;
+                    }
+                    data = _data + offset;
+                    offset += count;
+                }
+
+                if (count > _header.length - image)
+                {
+                    setError(resBadFormat);
+                    return;
+                }
+
+                OMFBody b;
+                b.offset = image;
+                b.length = count;
+                b.data = data;
+                _bodies.push_back(b);
+
+                image += count;
+                continue;
+            }
+
+            unsigned size = RelocationSize(opcode);
+
+            if (opcode == omfSUPER)
+            {
+                if (offset + 5 > end)
+                {
+                    setError(resBadFormat);
+                    return;
+                }
+                size = 5 + read32(_data + offset + 1);
+            }
+
+            if (size == 0 || size > end - offset)
+            {
+                // not a load segment record.
+                setError(resBadFormat);
+                return;
+            }
+
+            if (_dictionary == 0) _dictionary = offset;
+            offset += size;
+        }
+
+        _error = 0;
+    }
+
+
+    void OMFSegment::decodeRelocations()
+    {
+        _decoded = true;
+
+        if (_error || _dictionary == 0) return;
+
+        // parse() has already verified the record boundaries.
+        // usually this is a single LCONST followed by the dictionary, but
+        // LCONST/DS records may be interleaved.
+
+        unsigned offset = _dictionary;
+
+        for(;;)
+        {
+            const uint8_t *cp = _data + offset;
+            unsigned opcode = *cp;
+
+            if (opcode == omfEND) break;
+
+            if (opcode == omfSUPER)
+            {
+                unsigned length = read32(cp + 1);
+
+                if (length)
+                {
+                    OMFSuper s;
+                    s.type = cp[5];
+                    s.length = length - 1;
+                    s.data = cp + 6;
+                    _super.push_back(s);
+                }
+
+                offset += 5 + length;
+                continue;
+            }
+
+            OMFRelocation r;
+
+            r.opcode = opcode;
+            r.byteCount = cp[1];
+            r.shift = (int8_t)cp[2];
+            r.fileNum = 1;
+            r.segNum = _header.segNum;
+
+            switch (opcode)
+            {
+                case omfRELOC:
+                    r.offset = read32(cp + 3);
+                    r.reference = read32(cp + 7);
+                    break;
+
+                case omfINTERSEG:
+                    r.offset = read32(cp + 3);
+                    r.fileNum = read16(cp + 7);
+                    r.segNum = read16(cp + 9);
+                    r.reference = read32(cp + 11);
+                    break;
+
+                case omfcRELOC:
+                    r.offset = read16(cp + 3);
+                    r.reference = read16(cp + 5);
+                    break;
+
+                case omfcINTERSEG:
+                    r.offset = read16(cp + 3);
+                    r.segNum = cp[5];
+                    r.reference = read16(cp + 6);
+                    break;
+
+                default:
+                    // LCONST/DS between relocation groups.
+                    if (opcode == omfLCONST)
+                        offset += 5 + read32(cp + 1);
+                    else if (opcode == omfDS)
+                        offset += 5;
+                    else
+                        offset += 1 + opcode;
+                    continue;
+            }
+
+            _relocations.push_back(r);
+            offset += RelocationSize(opcode);
+        }
+    }
+
+
+    const std::vector<OMFRelocation>& OMFSegment::relocations()
+    {
+        if (!_decoded) decodeRelocations();
+        return _relocations;
+    }
+
+    const std::vector<OMFSuper>& OMFSegment::superRecords()
+    {
+        if (!_decoded) decodeRelocations();
+        return _super;
+    }
+
+
+    bool OMFSegment::load(uint8_t *buffer, unsigned length, uint32_t address)
+    {
+        if (_error) return false;
+
+        if (buffer == NULL || length < _header.length)
+        {
+            setError(resIndexRange);
+            return false;
+        }
+
+        unsigned image = 0;
+
+        for (std::vector<OMFBody>::iterator iter = _bodies.begin(); iter != _bodies.end(); ++iter)
+        {
+            if (iter->data) std::memcpy(buffer + iter->offset, iter->data, iter->length);
+            else std::memset(buffer + iter->offset, 0, iter->length);
+
+            image = iter->offset + iter->length;
+        }
+
+        // LENGTH may include uninitialized space past the last record.
+        std::memset(buffer + image, 0, _header.length - image);
+
+        return relocate(buffer, length, address);
+    }
+
+
+    bool OMFSegment::relocate(uint8_t *buffer, unsigned length, uint32_t address)
+    {
+        if (_error) return false;
+
+        if (!_decoded) decodeRelocations();
+
+        for (std::vector<OMFRelocation>::iterator iter = _relocations.begin(); iter != _relocations.end(); ++iter)
+        {
+            const OMFRelocation &r = *iter;
+
+            // other segments aren't loaded, so only self references can be resolved.
+            if (r.isInterSegment() && (r.fileNum != 1 || r.segNum != _header.segNum))
+                continue;
+
+            if (r.byteCount == 0 || r.byteCount > 4 || r.offset > length || r.byteCount > length - r.offset
+                || r.shift <= -32 || r.shift >= 32)
+            {
+                setError(resBadFormat);
+                return false;
+            }
+
+            uint32_t value = r.reference + address;
+
+            if (r.shift < 0) value >>= -r.shift;
+            else value <<= r.shift;
+
+            write(buffer + r.offset, value, r.byteCount);
+        }
+
+        for (std::vector<OMFSuper>::iterator iter = _super.begin(); iter != _super.end(); ++iter)
+        {
+            if (!applySuper(*iter, buffer, length, address)) return false;
+        }
+
+        _error = 0;
+        return true;
+    }
+
+
+    /*
+     * SUPER records are a compressed list of patch offsets, one subrecord per 256-byte page:
+     * if the high bit is set, skip (count & 0x7f) pages; otherwise (count + 1) offsets follow.
+     * The patch location holds the reference, so this is done in place without decoding.
+     */
+    bool OMFSegment::applySuper(const OMFSuper& s, uint8_t *buffer, unsigned length, uint32_t address)
+    {
+        unsigned patchSize;
+
+        switch (s.type)
+        {
+            case superRELOC2:
+                patchSize = 2;
+                break;
+            case superRELOC3:
+                patchSize = 3;
+                break;
+            default:
+                // SUPER INTERSEG -- references another segment.
+                return true;
+        }
+
+        const uint8_t *cp = s.data;
+        const uint8_t *end = s.data + s.length;
+        unsigned page = 0;
+
+        while (cp < end)
+        {
+            unsigned count = *cp++;
+
+            if (count & 0x80)
+            {
+                page += count & 0x7f;
+                if (page > 0x01000000) page = 0x01000000;
+                continue;
+            }
+
+            count += 1;
+            if (count > (unsigned)(end - cp))
+            {
+                setError(resBadFormat);
+                return false;
+            }
+
+            // also keeps page << 8 from wrapping.
+            if (page > (length >> 8)) goto range;
+
+            unsigned base = page << 8;
+
+            // the whole page (plus patch overhang) is in range, so skip the per-patch check.
+            bool checked = base + 256 + patchSize - 1 > length;
+
+            if (patchSize == 2)
+            {
+                for (unsigned i = 0; i < count; ++i)
+                {
+                    unsigned offset = base + cp[i];
+                    if (checked && offset + 2 > length) goto range;
+
+                    uint8_t *p = buffer + offset;
+                    write(p, read16(p) + address, 2);
+                }
+            }
+            else
+            {
+                for (unsigned i = 0; i < count; ++i)
+                {
+                    unsigned offset = base + cp[i];
+                    if (checked && offset + 3 > length) goto range;
+
+                    uint8_t *p = buffer + offset;
+                    write(p, read24(p) + address, 3);
+                }
+            }
+
+            cp += count;
+            page += 1;
+        }
+
+        return true;
+
+    range:
+        setError(resBadFormat);
+        return false;
+    }
@@ -0,0 +1,181 @@
+/*
+ *  OMF.h
+ *  IIgsResource
+ *
+ *  OMF (v2) load segment parser for code resources
+ *  (rCodeResource, rCDEVCode, rXCMD, rXFCN, rCtlDefProc).
+ *
+ */
+
+#ifndef __PRODOS_OMF_H__
+#define __PRODOS_OMF_H__
+
+#include "ResourceManager.h"
+
+#ifdef __cplusplus
+
+namespace IIgs {
+
+    /*
+     * OMF record opcodes
+     */
+    enum {
+        omfEND              = 0x00,
+        omfCONST            = 0x01,         /* 0x01 - 0xdf */
+        omfALIGN            = 0xe0,
+        omfORG              = 0xe1,
+        omfRELOC            = 0xe2,
+        omfINTERSEG         = 0xe3,
+        omfUSING            = 0xe4,
+        omfSTRONG           = 0xe5,
+        omfGLOBAL           = 0xe6,
+        omfGEQU             = 0xe7,
+        omfMEM              = 0xe8,
+        omfEXPR             = 0xeb,
+        omfZEXPR            = 0xec,
+        omfBEXPR            = 0xed,
+        omfRELEXPR          = 0xee,
+        omfLOCAL            = 0xef,
+        omfEQU              = 0xf0,
+        omfDS               = 0xf1,
+        omfLCONST           = 0xf2,
+        omfLEXPR            = 0xf3,
+        omfENTRY            = 0xf4,
+        omfcRELOC           = 0xf5,
+        omfcINTERSEG        = 0xf6,
+        omfSUPER            = 0xf7
+    };
+
+    /*
+     * SUPER record types
+     */
+    enum {
+        superRELOC2         = 0,
+        superRELOC3         = 1,
+        superINTERSEG1      = 2             /* 2 - 37 */
+    };
+
+
+    typedef struct OMFHeader {
+        unsigned    byteCount;
+        unsigned    reserveSpace;
+        unsigned    length;
+        unsigned    labelLength;
+        unsigned    numberLength;
+        unsigned    version;
+        unsigned    bankSize;
+        unsigned    kind;
+        unsigned    org;
+        unsigned    align;
+        unsigned    segNum;
+        unsigned    entry;
+        unsigned    dispName;
+        unsigned    dispData;
+
+        const uint8_t *loadName;            /* 10 bytes, space padded */
+        const uint8_t *segName;             /* not NUL terminated */
+        unsigned    segNameLength;
+    } OMFHeader;
+
+
+    /*
+     * A piece of the memory image; data is NULL for DS (zero-fill) records.
+     */
+    typedef struct OMFBody {
+        unsigned    offset;                 /* offset within the memory image */
+        unsigned    length;
+        const uint8_t *data;
+    } OMFBody;
+
+
+    /*
+     * RELOC, cRELOC, INTERSEG and cINTERSEG records.
+     * SUPER records are kept as raw views and applied directly.
+     */
+    typedef struct OMFRelocation {
+        unsigned    opcode;
+        unsigned    byteCount;
+        int         shift;
+        unsigned    offset;                 /* offset of the patch */
+        unsigned    reference;
+        unsigned    fileNum;                /* INTERSEG only */
+        unsigned    segNum;                 /* INTERSEG only */
+
+        bool isInterSegment() const { return opcode == omfINTERSEG || opcode == omfcINTERSEG; }
+    } OMFRelocation;
+
+
+    typedef struct OMFSuper {
+        unsigned    type;
+        unsigned    length;                 /* length of the subrecord data */
+        const uint8_t *data;
+    } OMFSuper;
+
+
+
+    /*
+     * Parses a single OMF segment in place -- the data is not copied and must
+     * outlive the OMFSegment.
+     *
+     * The header and record layout are scanned on construction; relocation
+     * dictionaries are decoded the first time they are needed.
+     */
+    class OMFSegment {
+
+    public:
+
+        OMFSegment(const uint8_t *data, unsigned length, unsigned options = 0);
+        OMFSegment(const std::pair<const uint8_t *, unsigned>& resource, unsigned options = 0);
+
+        static bool isCodeResource(ResType resType);
+
+        unsigned error() const { return _error; }
+
+        // total size of the segment, including the header.
+        unsigned size() const { return _header.byteCount; }
+
+        const OMFHeader& header() const { return _header; }
+        std::string segmentName() const;
+        std::string loadName() const;
+
+        const std::vector<OMFBody>& bodies() const { return _bodies; }
+
+        const std::vector<OMFRelocation>& relocations();
+        const std::vector<OMFSuper>& superRecords();
+
+        // copy bodies into buffer (zero-filling DS), then relocate.
+        bool load(uint8_t *buffer, unsigned length, uint32_t address);
+
+        // apply intra-segment relocations to an already loaded image.
+        bool relocate(uint8_t *buffer, unsigned length, uint32_t address);
+
+    private:
+
+        void parse();
+        void decodeRelocations();
+        void setError(unsigned error);
+
+        bool applySuper(const OMFSuper& s, uint8_t *buffer, unsigned length, uint32_t address);
+
+        const uint8_t *_data;
+        unsigned _length;
+        unsigned _options;
+
+        OMFHeader _header;
+        std::vector<OMFBody> _bodies;
+
+        // start of the relocation dictionary (after the last LCONST/DS)
+        unsigned _dictionary;
+
+        bool _decoded;
+        std::vector<OMFRelocation> _relocations;
+        std::vector<OMFSuper> _super;
+
+        unsigned _error;
+    };
+
+} // namespace
+
+#endif
+
+#endif
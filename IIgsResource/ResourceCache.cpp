@@ -0,0 +1,278 @@
+/*
+ *  ResourceCache.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ResourceCache.h"
+#include "ResourceConverter.h"
+
+#include <map>
+
+#include <pthread.h>
+
+using namespace IIgs;
+
+
+namespace {
+
+    struct Key {
+        uint32_t fork;
+        ResType resType;
+        ResID resID;
+
+        bool operator<(const Key& k) const
+        {
+            if (fork != k.fork) return fork < k.fork;
+            if (resType != k.resType) return resType < k.resType;
+            return resID < k.resID;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        ConvertedResource *object;
+        Entry *prev;
+        Entry *next;
+    };
+
+    typedef std::map<Key, Entry *> EntryMap;
+
+}
+
+
+namespace IIgs {
+
+    struct ResourceCache::Shard {
+
+        pthread_mutex_t lock;
+        EntryMap entries;
+
+        // LRU list; head.next is the most recently used.
+        Entry head;
+
+        // bytes used by the whole cache.
+        volatile unsigned *total;
+
+        Shard()
+        {
+            pthread_mutex_init(&lock, NULL);
+            head.prev = head.next = &head;
+            head.object = NULL;
+            total = NULL;
+        }
+
+        ~Shard()
+        {
+            clear();
+            pthread_mutex_destroy(&lock);
+        }
+
+        void unlink(Entry *e)
+        {
+            e->prev->next = e->next;
+            e->next->prev = e->prev;
+        }
+
+        void pushFront(Entry *e)
+        {
+            e->next = head.next;
+            e->prev = &head;
+            head.next->prev = e;
+            head.next = e;
+        }
+
+        void remove(Entry *e)
+        {
+            unlink(e);
+            entries.erase(e->key);
+            __sync_fetch_and_sub(total, e->object->size());
+            e->object->release();
+            delete e;
+        }
+
+        // drop least recently used entries (other than keep) until the cache fits.
+        void evict(unsigned budget, Entry *keep = NULL)
+        {
+            while (*total > budget && head.prev != &head && head.prev != keep)
+                remove(head.prev);
+        }
+
+        void clear()
+        {
+            while (head.next != &head)
+                remove(head.next);
+        }
+    };
+
+} // namespace
+
+
+
+    ResourceCache::ResourceCache(unsigned budget, unsigned shards)
+    {
+        if (shards == 0) shards = 1;
+
+        _shards = new Shard[shards];
+        _shardCount = shards;
+        _budget = budget;
+        _size = 0;
+        _hits = 0;
+        _misses = 0;
+
+        for (unsigned i = 0; i < shards; ++i)
+            _shards[i].total = &_size;
+    }
+
+    ResourceCache::~ResourceCache()
+    {
+        delete[] _shards;
+    }
+
+
+    ResourceCache::Shard *ResourceCache::shard(uint32_t fork, ResType resType, ResID resID)
+    {
+        uint32_t h = fork * 2654435761u;
+        h ^= resType * 40503u;
+        h ^= resID * 2246822519u;
+        h ^= h >> 15;
+
+        return _shards + (h % _shardCount);
+    }
+
+
+    ConvertedResource *ResourceCache::lookup(uint32_t fork, ResType resType, ResID resID)
+    {
+        Shard *s = shard(fork, resType, resID);
+        Key key = { fork, resType, resID };
+        ConvertedResource *object = NULL;
+
+        pthread_mutex_lock(&s->lock);
+
+        EntryMap::iterator iter = s->entries.find(key);
+        if (iter != s->entries.end())
+        {
+            Entry *e = iter->second;
+
+            s->unlink(e);
+            s->pushFront(e);
+
+            object = e->object;
+            object->retain();
+        }
+
+        pthread_mutex_unlock(&s->lock);
+
+        if (object) __sync_fetch_and_add(&_hits, 1);
+        else __sync_fetch_and_add(&_misses, 1);
+
+        return object;
+    }
+
+
+    ConvertedResource *ResourceCache::insert(uint32_t fork, ResType resType, ResID resID, ConvertedResource *object)
+    {
+        if (object == NULL) return NULL;
+
+        Shard *s = shard(fork, resType, resID);
+        Key key = { fork, resType, resID };
+
+        pthread_mutex_lock(&s->lock);
+
+        EntryMap::iterator iter = s->entries.find(key);
+        if (iter != s->entries.end())
+        {
+            ConvertedResource *existing = iter->second->object;
+            existing->retain();
+            pthread_mutex_unlock(&s->lock);
+            return existing;
+        }
+
+        object->retain();
+
+        // too big to ever fit -- don't flush the cache for it.
+        bool added = object->size() <= _budget;
+
+        if (added)
+        {
+            Entry *e = new Entry;
+            e->key = key;
+            e->object = object;
+            object->retain();
+
+            s->entries[key] = e;
+            s->pushFront(e);
+            __sync_fetch_and_add(&_size, object->size());
+
+            s->evict(_budget, e);
+        }
+
+        pthread_mutex_unlock(&s->lock);
+
+        // still over budget -- take it from the other shards.
+        if (added && _size > _budget) trim(s);
+
+        return object;
+    }
+
+
+    /*
+     * Evicts from every shard but skip (which holds the newest entry) until
+     * the cache fits.  Only one shard lock is held at a time.
+     */
+    void ResourceCache::trim(Shard *skip)
+    {
+        unsigned start = skip ? skip - _shards + 1 : 0;
+
+        for (unsigned i = 0; i < _shardCount && _size > _budget; ++i)
+        {
+            Shard *s = _shards + (start + i) % _shardCount;
+            if (s == skip) continue;
+
+            pthread_mutex_lock(&s->lock);
+            s->evict(_budget);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+
+
+    void ResourceCache::purge(uint32_t fork)
+    {
+        Key first = { fork, 0, 0 };
+
+        for (unsigned i = 0; i < _shardCount; ++i)
+        {
+            Shard *s = _shards + i;
+
+            pthread_mutex_lock(&s->lock);
+
+            EntryMap::iterator iter = s->entries.lower_bound(first);
+            while (iter != s->entries.end() && iter->first.fork == fork)
+            {
+                Entry *e = iter->second;
+                ++iter;
+                s->remove(e);
+            }
+
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+
+    void ResourceCache::clear()
+    {
+        for (unsigned i = 0; i < _shardCount; ++i)
+        {
+            Shard *s = _shards + i;
+
+            pthread_mutex_lock(&s->lock);
+            s->clear();
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+
+
+    void ResourceCache::setBudget(unsigned budget)
+    {
+        _budget = budget;
+        trim(NULL);
+    }
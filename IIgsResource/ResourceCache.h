@@ -0,0 +1,81 @@
+/*
+ *  ResourceCache.h
+ *  IIgsResource
+ *
+ *  Size bounded LRU cache of converted resources, shared by any number of forks.
+ *
+ */
+
+#ifndef __PRODOS_RESOURCE_CACHE_H__
+#define __PRODOS_RESOURCE_CACHE_H__
+
+#include "ResourceManager.h"
+
+#ifdef __cplusplus
+
+namespace IIgs {
+
+    class ConvertedResource;
+
+    /*
+     * The cache is split into shards, each with its own lock and LRU list.
+     * The budget (in ConvertedResource::size() bytes) is shared: a single
+     * object may use all of it, and inserting evicts from the inserting
+     * shard first, then the others.  Eviction is LRU within a shard, not
+     * across the whole cache.  Entries are keyed by (fork, type, id), where
+     * fork is ResourceManager::serial().
+     *
+     * The cache must outlive every ResourceManager that uses it.
+     */
+    class ResourceCache {
+
+    public:
+
+        ResourceCache(unsigned budget, unsigned shards = 16);
+        ~ResourceCache();
+
+        // returns a retained object, or NULL.
+        ConvertedResource *lookup(uint32_t fork, ResType resType, ResID resID);
+
+        /*
+         * Adds an object (the cache takes its own reference).  If another thread
+         * inserted the same key first, that object is returned (retained) instead;
+         * otherwise object is returned (retained).
+         */
+        ConvertedResource *insert(uint32_t fork, ResType resType, ResID resID, ConvertedResource *object);
+
+        // drop everything belonging to a fork.
+        void purge(uint32_t fork);
+        void clear();
+
+        void setBudget(unsigned budget);
+        unsigned budget() const { return _budget; }
+
+        unsigned size() const { return _size; }
+        unsigned hits() const { return _hits; }
+        unsigned misses() const { return _misses; }
+
+    private:
+
+        ResourceCache(const ResourceCache&);
+        ResourceCache& operator=(const ResourceCache&);
+
+        struct Shard;
+
+        Shard *shard(uint32_t fork, ResType resType, ResID resID);
+        void trim(Shard *skip);
+
+        Shard *_shards;
+        unsigned _shardCount;
+        volatile unsigned _budget;
+        volatile unsigned _size;
+
+        unsigned _hits;
+        unsigned _misses;
+    };
+
+} // namespace
+
+#endif
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ *  ResourceClient.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ResourceClient.h"
+#include "ResourceFork.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+using namespace IIgs;
+
+
+namespace IIgs {
+
+    const char *SharedIndexSegment = "/iigsresources";
+    const char *SharedIndexSocket = "/tmp/iigsresources.sock";
+
+
+    uint32_t SharedIndexHash(const char *path, unsigned length)
+    {
+        uint32_t h = 2166136261u;
+
+        for (unsigned i = 0; i < length; ++i)
+        {
+            h ^= (uint8_t)path[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+
+    std::string SharedIndexKey(const char *path)
+    {
+        if (path[0] == '/') return path;
+
+        char buffer[PATH_MAX];
+        if (!getcwd(buffer, sizeof(buffer))) return path;
+
+        std::string rv(buffer);
+        if (rv.empty() || rv[rv.length() - 1] != '/') rv.push_back('/');
+        rv.append(path);
+        return rv;
+    }
+
+} // namespace
+
+
+    ResourceClient::ResourceClient(const char *segment, const char *socket, unsigned options)
+    {
+        _header = NULL;
+        _size = 0;
+        _segment = segment ? segment : SharedIndexSegment;
+        _socket = socket ? socket : SharedIndexSocket;
+        _options = options;
+        _error = 0;
+
+        if (!map()) setError(resNoCurFile);
+    }
+
+    ResourceClient::~ResourceClient()
+    {
+        if (_header) munmap((void *)_header, _size);
+    }
+
+
+    void ResourceClient::setError(unsigned error)
+    {
+        _error = error;
+        if (error && _options & rmThrow)
+        {
+            throw error;
+        }
+    }
+
+
+    bool ResourceClient::map()
+    {
+        if (_header) return true;
+
+        int fd = shm_open(_segment.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+
+        struct stat st;
+        void *p = MAP_FAILED;
+
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SharedIndexHeader) && st.st_size <= UINT_MAX)
+            p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        ::close(fd);
+
+        if (p == MAP_FAILED) return false;
+
+        const SharedIndexHeader *h = (const SharedIndexHeader *)p;
+
+        if (h->magic != SharedIndexMagic || h->version != SharedIndexVersion
+            || h->recordSize != sizeof(ResourceRecord) || h->capacity > st.st_size)
+        {
+            munmap(p, st.st_size);
+            return false;
+        }
+
+        _header = h;
+        _size = st.st_size;
+        return true;
+    }
+
+
+    /*
+     * The segment belongs to another process, so nothing in it is trusted:
+     * every offset is checked against the mapping before it's used.
+     */
+    bool ResourceClient::valid(const SharedFork *f) const
+    {
+        if (f->dataOffset > _size || f->length > _size - f->dataOffset) return false;
+
+        if (f->recordOffset > _size || f->recordOffset % sizeof(uint32_t)
+            || f->recordCount > (_size - f->recordOffset) / sizeof(ResourceRecord))
+            return false;
+
+        if (f->typeOffset > _size || f->typeOffset % sizeof(ResType)
+            || f->typeCount > (_size - f->typeOffset) / sizeof(ResType))
+            return false;
+
+        return true;
+    }
+
+
+    const SharedFork *ResourceClient::lookup(const std::string& path, unsigned *error) const
+    {
+        *error = 0;
+        if (!_header) return NULL;
+
+        const uint8_t *base = (const uint8_t *)_header;
+        const unsigned first = sizeof(SharedIndexHeader);
+        const unsigned fixed = offsetof(SharedFork, path);
+        uint32_t hash = SharedIndexHash(path.data(), path.length());
+
+        uint32_t offset = ((const volatile uint32_t *)_header->buckets)[hash % SharedIndexBuckets];
+
+        // pairs with the barrier before rsrcd publishes the entry.
+        __sync_synchronize();
+
+        while (offset)
+        {
+            if (offset < first || offset > _size - fixed || offset % sizeof(uint32_t))
+            {
+                *error = resBadFormat;
+                return NULL;
+            }
+
+            const SharedFork *f = (const SharedFork *)(base + offset);
+
+            if (f->pathLength > _size - offset - fixed)
+            {
+                *error = resBadFormat;
+                return NULL;
+            }
+
+            if (f->hash == hash && f->pathLength == path.length()
+                && std::memcmp(f->path, path.data(), path.length()) == 0)
+            {
+                if (!valid(f))
+                {
+                    *error = resBadFormat;
+                    return NULL;
+                }
+                return f;
+            }
+
+            // entries are appended, so a chain always moves backwards -- no cycles.
+            if (f->next >= offset)
+            {
+                *error = resBadFormat;
+                return NULL;
+            }
+            offset = f->next;
+        }
+
+        return NULL;
+    }
+
+    const SharedFork *ResourceClient::find(const char *path) const
+    {
+        if (path == NULL || *path == 0) return NULL;
+
+        unsigned error;
+        return lookup(SharedIndexKey(path), &error);
+    }
+
+
+    unsigned ResourceClient::attach(const char *path)
+    {
+        if (path == NULL || *path == 0)
+        {
+            setError(resFileNotFound);
+            return _error;
+        }
+
+        std::string p = SharedIndexKey(path);
+
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if (_socket.length() >= sizeof(addr.sun_path))
+        {
+            setError(resNoCurFile);
+            return _error;
+        }
+        std::strcpy(addr.sun_path, _socket.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            setError(resNoCurFile);
+            return _error;
+        }
+
+        // don't hang if rsrcd is stuck (it only spends SharedIndexTimeout on any one client).
+        struct timeval tv;
+        tv.tv_sec = SharedIndexTimeout * 5;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        /*
+         * request: uint32_t length, path
+         * reply:   uint32_t error
+         */
+        uint32_t length = p.length();
+        uint32_t error = resNoCurFile;
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0
+            && WriteAll(fd, &length, sizeof(length))
+            && WriteAll(fd, p.data(), length))
+        {
+            if (!ReadAll(fd, &error, sizeof(error))) error = resNoCurFile;
+        }
+
+        ::close(fd);
+
+        // the segment exists once rsrcd has answered.
+        if (!error && !map()) error = resNoCurFile;
+
+        setError(error);
+        return error;
+    }
+
+
+    ResourceManager *ResourceClient::open(const std::string& path, unsigned options)
+    {
+        return open(path.c_str(), options);
+    }
+
+    ResourceManager *ResourceClient::open(const char *path, unsigned options)
+    {
+        if (path == NULL || *path == 0)
+        {
+            setError(resFileNotFound);
+            return NULL;
+        }
+
+        std::string p = SharedIndexKey(path);
+
+        unsigned error;
+        const SharedFork *f = lookup(p, &error);
+        if (!f && !error)
+        {
+            if (attach(p.c_str())) return NULL;
+
+            f = lookup(p, &error);
+            if (!f && !error) error = resFileNotFound;
+        }
+
+        if (!f)
+        {
+            setError(error);
+            return NULL;
+        }
+
+        const uint8_t *base = (const uint8_t *)_header;
+
+        // the data belongs to the segment.
+        options &= ~(rmFree | rmDelete | rmThrow);
+
+        // the ResourceManager checks the records against the fork length.
+        ResourceManager *rm = new ResourceManager(base + f->dataOffset, f->length,
+            (const ResourceRecord *)(base + f->recordOffset), f->recordCount,
+            (const ResType *)(base + f->typeOffset), f->typeCount, options);
+
+        if (rm->error())
+        {
+            delete rm;
+            setError(resBadFormat);
+            return NULL;
+        }
+
+        _error = 0;
+        return rm;
+    }
@@ -0,0 +1,133 @@
+/*
+ *  ResourceClient.h
+ *  IIgsResource
+ *
+ *  Client side of rsrcd, which keeps parsed forks in a shared memory segment
+ *  so short-lived processes don't have to read and index them each time.
+ *
+ */
+
+#ifndef __PRODOS_RESOURCE_CLIENT_H__
+#define __PRODOS_RESOURCE_CLIENT_H__
+
+#include "ResourceManager.h"
+
+#ifdef __cplusplus
+
+namespace IIgs {
+
+    // defaults for rsrcd -s and -S.
+    extern const char *SharedIndexSegment;
+    extern const char *SharedIndexSocket;
+
+
+    enum {
+        SharedIndexMagic    = 0x4d485352,   // 'RSHM'
+        SharedIndexVersion  = 1,
+        SharedIndexBuckets  = 1024,
+        SharedIndexTimeout  = 1         // seconds rsrcd waits on a client's request
+    };
+
+
+    /*
+     * Segment layout.  Everything is in native byte order and offsets are from
+     * the start of the segment.  The segment is append-only: rsrcd writes a fork
+     * (data, records, types, then the SharedFork) into unused space and only then
+     * links it into its hash bucket, after a memory barrier.  Readers never see
+     * a partial entry and entries never move, so no locking is needed.
+     *
+     * records and types are exactly what ResourceManager::resources() and types()
+     * return, resOffset relative to the fork data.
+     */
+    struct SharedIndexHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;            // sizeof(ResourceRecord)
+        uint32_t capacity;              // segment size
+        uint32_t used;                  // bytes allocated (daemon only)
+        uint32_t count;                 // forks published
+        uint32_t buckets[SharedIndexBuckets];   // SharedFork offsets, 0 = end of chain
+    };
+
+    struct SharedFork {
+        uint32_t next;                  // next SharedFork in the bucket
+        uint32_t hash;
+        uint32_t dataOffset;
+        uint32_t length;
+        uint32_t recordOffset;
+        uint32_t recordCount;
+        uint32_t typeOffset;
+        uint32_t typeCount;
+        uint32_t pathLength;
+        char path[1];                   // 0-terminated
+    };
+
+    // hash of a fork path (FNV-1a).
+    uint32_t SharedIndexHash(const char *path, unsigned length);
+
+    /*
+     * The key a fork is published under -- path made absolute with the current
+     * directory, but not otherwise canonicalized.  rsrcd and ResourceClient both
+     * use this, so lookups only hit when the keys match byte for byte.
+     */
+    std::string SharedIndexKey(const char *path);
+
+
+    /*
+     * Maps the segment read-only (if rsrcd isn't running yet, that's retried
+     * after the first attach).  open() looks the path up in the segment and,
+     * if it isn't there, asks rsrcd (over the unix socket) to attach it.  The
+     * ResourceManager it returns uses the shared index and data directly, so
+     * getResourceRecord, loadResource, findNamedResource, etc. never leave
+     * the process.
+     *
+     * Paths are looked up by SharedIndexKey, so use the same spelling as
+     * rsrcd's other clients.
+     *
+     * ResourceManagers from open() must be deleted before the ResourceClient.
+     */
+    class ResourceClient {
+
+    public:
+
+        // NULL for the defaults.  options may include rmThrow.
+        ResourceClient(const char *segment = NULL, const char *socket = NULL, unsigned options = 0);
+        ~ResourceClient();
+
+        unsigned error() const { return _error; }
+        bool isConnected() const { return _header != NULL; }
+
+        // returns a new ResourceManager (delete when done) or NULL.
+        ResourceManager *open(const char *path, unsigned options = 0);
+        ResourceManager *open(const std::string& path, unsigned options = 0);
+
+        // looks in the segment only; returns NULL if the fork isn't attached.
+        const SharedFork *find(const char *path) const;
+
+        // ask rsrcd to attach a fork.  returns 0 or an error code.
+        unsigned attach(const char *path);
+
+    private:
+
+        ResourceClient(const ResourceClient&);
+        ResourceClient& operator=(const ResourceClient&);
+
+        void setError(unsigned error);
+        bool map();
+        bool valid(const SharedFork *f) const;
+        const SharedFork *lookup(const std::string& path, unsigned *error) const;
+
+        const SharedIndexHeader *_header;
+        unsigned _size;
+
+        std::string _segment;
+        std::string _socket;
+        unsigned _options;
+        unsigned _error;
+    };
+
+} // namespace
+
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  ResourceConverter.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ResourceConverter.h"
+
+using namespace IIgs;
+
+
+
+#pragma mark ConvertedResource
+
+    ConvertedResource::ConvertedResource(unsigned size)
+    {
+        _size = size;
+        _refCount = 1;
+    }
+
+    ConvertedResource::~ConvertedResource()
+    {
+    }
+
+    void ConvertedResource::retain()
+    {
+        __sync_fetch_and_add(&_refCount, 1);
+    }
+
+    void ConvertedResource::release()
+    {
+        if (__sync_sub_and_fetch(&_refCount, 1) == 0) delete this;
+    }
+
+
+#pragma mark ResourceConverter
+
+    ResourceConverter::~ResourceConverter()
+    {
+    }
+
+
+#pragma mark ConverterRegistry
+
+    ConverterRegistry::ConverterRegistry()
+    {
+    }
+
+    ConverterRegistry::~ConverterRegistry()
+    {
+    }
+
+    unsigned ConverterRegistry::logIn(ResType resType, ResourceConverter *converter)
+    {
+        if (resType == 0 || converter == NULL) return resInvalidTypeOrID;
+
+        std::map<ResType, ResourceConverter *>::iterator iter = _converters.find(resType);
+
+        if (iter != _converters.end())
+            return iter->second == converter ? 0 : resDiffConverter;
+
+        _converters[resType] = converter;
+        return 0;
+    }
+
+    unsigned ConverterRegistry::logOut(ResType resType)
+    {
+        return _converters.erase(resType) ? 0 : resNoConverter;
+    }
+
+    ResourceConverter *ConverterRegistry::converter(ResType resType) const
+    {
+        std::map<ResType, ResourceConverter *>::const_iterator iter = _converters.find(resType);
+
+        return iter == _converters.end() ? NULL : iter->second;
+    }
@@ -0,0 +1,93 @@
+/*
+ *  ResourceConverter.h
+ *  IIgsResource
+ *
+ *  Per-type converters, like the IIgs ResourceConverter call.
+ *
+ */
+
+#ifndef __PRODOS_RESOURCE_CONVERTER_H__
+#define __PRODOS_RESOURCE_CONVERTER_H__
+
+#include "ResourceManager.h"
+
+#ifdef __cplusplus
+#include <map>
+
+namespace IIgs {
+
+    /*
+     * A decoded resource.  These are reference counted since a cache may
+     * evict one while a caller is still using it.  A new object has a
+     * reference count of 1.
+     */
+    class ConvertedResource {
+
+    public:
+
+        ConvertedResource(unsigned size = 0);
+
+        void retain();
+        void release();
+
+        // approximate memory footprint, used for the cache budget.
+        unsigned size() const { return _size; }
+
+    protected:
+
+        virtual ~ConvertedResource();
+
+        unsigned _size;
+
+    private:
+
+        ConvertedResource(const ConvertedResource&);
+        ConvertedResource& operator=(const ConvertedResource&);
+
+        unsigned _refCount;
+    };
+
+
+    class ResourceConverter {
+
+    public:
+
+        virtual ~ResourceConverter();
+
+        // returns NULL and sets *error on failure.
+        virtual ConvertedResource *convert(ResType resType, ResID resID, const uint8_t *data, unsigned size, unsigned *error) = 0;
+    };
+
+
+    /*
+     * Converters are owned by the caller and must outlive the registry.
+     * logIn/logOut are not thread safe; lookups are.
+     */
+    class ConverterRegistry {
+
+    public:
+
+        ConverterRegistry();
+        ~ConverterRegistry();
+
+        // returns resDiffConverter if a different converter is already logged in.
+        unsigned logIn(ResType resType, ResourceConverter *converter);
+
+        // returns resNoConverter if no converter is logged in.
+        unsigned logOut(ResType resType);
+
+        ResourceConverter *converter(ResType resType) const;
+
+    private:
+
+        ConverterRegistry(const ConverterRegistry&);
+        ConverterRegistry& operator=(const ConverterRegistry&);
+
+        std::map<ResType, ResourceConverter *> _converters;
+    };
+
+} // namespace
+
+#endif
+
+#endif
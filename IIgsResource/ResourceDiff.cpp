@@ -0,0 +1,107 @@
+/*
+ *  ResourceDiff.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ResourceDiff.h"
+
+#include <cstring>
+
+using namespace IIgs;
+
+
+
+    const static ResourceRecord InvalidRecord = { 0, 0, 0, 0, 0, -1 };
+
+
+    static inline int Compare(const ResourceRecord& a, const ResourceRecord& b)
+    {
+        if (a.resType != b.resType) return a.resType < b.resType ? -1 : 1;
+        if (a.resID != b.resID) return a.resID < b.resID ? -1 : 1;
+        return 0;
+    }
+
+
+    unsigned IIgs::DiffResources(ResourceManager& oldFork, ResourceManager& newFork,
+        std::vector<ResourceDelta>& deltas, unsigned options)
+    {
+        typedef std::pair<ResourceRecord, const uint8_t *> Entry;
+
+        unsigned oldCount = oldFork.countResources();
+        unsigned newCount = newFork.countResources();
+        unsigned start = deltas.size();
+
+        unsigned i = 0;
+        unsigned j = 0;
+
+        // both maps are sorted by (type, id), so this is a single merge pass.
+        while (i < oldCount || j < newCount)
+        {
+            ResourceDelta d;
+
+            if (j == newCount)
+            {
+                Entry a = oldFork.getIndexedResource(i++);
+                d.kind = rdRemoved;
+                d.oldRecord = a.first;
+                d.newRecord = InvalidRecord;
+            }
+            else if (i == oldCount)
+            {
+                Entry b = newFork.getIndexedResource(j++);
+                d.kind = rdAdded;
+                d.oldRecord = InvalidRecord;
+                d.newRecord = b.first;
+            }
+            else
+            {
+                Entry a = oldFork.getIndexedResource(i);
+                Entry b = newFork.getIndexedResource(j);
+
+                int cmp = Compare(a.first, b.first);
+
+                if (cmp < 0)
+                {
+                    ++i;
+                    d.kind = rdRemoved;
+                    d.oldRecord = a.first;
+                    d.newRecord = InvalidRecord;
+                }
+                else if (cmp > 0)
+                {
+                    ++j;
+                    d.kind = rdAdded;
+                    d.oldRecord = InvalidRecord;
+                    d.newRecord = b.first;
+                }
+                else
+                {
+                    ++i;
+                    ++j;
+                    d.oldRecord = a.first;
+                    d.newRecord = b.first;
+
+                    // metadata first; the bodies are only touched if it matches.
+                    if (a.first.resAttr != b.first.resAttr || a.first.resSize != b.first.resSize)
+                        d.kind = rdChanged;
+                    else if (a.second != b.second && std::memcmp(a.second, b.second, a.first.resSize))
+                        d.kind = rdChanged;
+                    else if (a.first.resOffset != b.first.resOffset)
+                        d.kind = rdMoved;
+                    else
+                        d.kind = rdUnchanged;
+                }
+            }
+
+            if (d.kind == rdUnchanged && !(options & rdIncludeUnchanged)) continue;
+
+            const ResourceRecord& r = d.kind == rdRemoved ? d.oldRecord : d.newRecord;
+            d.resType = r.resType;
+            d.resID = r.resID;
+
+            deltas.push_back(d);
+        }
+
+        return deltas.size() - start;
+    }
@@ -0,0 +1,57 @@
+/*
+ *  ResourceDiff.h
+ *  IIgsResource
+ *
+ */
+
+#ifndef __PRODOS_RESOURCE_DIFF_H__
+#define __PRODOS_RESOURCE_DIFF_H__
+
+#include "ResourceManager.h"
+
+#ifdef __cplusplus
+
+namespace IIgs {
+
+    /*
+     * Delta kinds
+     */
+    enum {
+        rdUnchanged     = 0,
+        rdAdded         = 1,        /* only in the new fork */
+        rdRemoved       = 2,        /* only in the old fork */
+        rdChanged       = 3,        /* attr, size or data differ */
+        rdMoved         = 4         /* same attr and data, different offset */
+    };
+
+    /*
+     * Diff options
+     */
+    enum {
+        rdIncludeUnchanged  = 1
+    };
+
+
+    typedef struct ResourceDelta {
+        unsigned        kind;
+        ResType         resType;
+        ResID           resID;
+        ResourceRecord  oldRecord;      /* invalid for rdAdded */
+        ResourceRecord  newRecord;      /* invalid for rdRemoved */
+    } ResourceDelta;
+
+
+    /*
+     * Compares two forks by merge-joining their (sorted) resource maps.
+     * Bodies are only compared when the attr and size match.
+     *
+     * Deltas are appended in (type, id) order; returns the number appended.
+     */
+    unsigned DiffResources(ResourceManager& oldFork, ResourceManager& newFork,
+        std::vector<ResourceDelta>& deltas, unsigned options = 0);
+
+} // namespace
+
+#endif
+
+#endif
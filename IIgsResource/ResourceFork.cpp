@@ -0,0 +1,250 @@
+/*
+ *  ResourceFork.cpp
+ *  IIgsResource
+ *
+ */
+
+#include "ResourceFork.h"
+
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace IIgs;
+
+
+#ifdef __APPLE__
+    const char *IIgs::ResourceForkXattr = "prodos.ResourceFork";
+    #define xgetxattr(path, name, buffer, size) getxattr(path, name, buffer, size, 0, 0)
+#else
+    // linux restricts unprivileged attributes to the user namespace.
+    const char *IIgs::ResourceForkXattr = "user.prodos.ResourceFork";
+    #define xgetxattr(path, name, buffer, size) getxattr(path, name, buffer, size)
+#endif
+
+
+
+    static uint8_t *ReadFile(const char *path, unsigned *length)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return NULL;
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0)
+        {
+            int e = errno;
+            ::close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        unsigned size = st.st_size;
+        uint8_t *data = new uint8_t[size ? size : 1];
+
+        if (!ReadAll(fd, data, size))
+        {
+            int e = errno;
+            delete[] data;
+            ::close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        ::close(fd);
+        *length = size;
+        return data;
+    }
+
+
+    static inline unsigned read16be(const uint8_t *x)
+    {
+        return (x[0] << 8) | x[1];
+    }
+
+    static inline unsigned read32be(const uint8_t *x)
+    {
+        return (x[0] << 24) | (x[1] << 16) | (x[2] << 8) | x[3];
+    }
+
+    bool IIgs::ReadAll(int fd, void *buffer, unsigned size)
+    {
+        uint8_t *cp = (uint8_t *)buffer;
+
+        while (size)
+        {
+            ssize_t l = ::read(fd, cp, size);
+            if (l < 0 && errno == EINTR) continue;
+            if (l <= 0)
+            {
+                if (l == 0) errno = EIO;
+                return false;
+            }
+            cp += l;
+            size -= l;
+        }
+        return true;
+    }
+
+    bool IIgs::WriteAll(int fd, const void *buffer, unsigned size)
+    {
+        const uint8_t *cp = (const uint8_t *)buffer;
+
+        while (size)
+        {
+            ssize_t l = ::write(fd, cp, size);
+            if (l < 0 && errno == EINTR) continue;
+            if (l <= 0)
+            {
+                if (l == 0) errno = EIO;
+                return false;
+            }
+            cp += l;
+            size -= l;
+        }
+        return true;
+    }
+
+
+    static bool ReadAt(int fd, uint8_t *data, unsigned size, unsigned offset)
+    {
+        while (size)
+        {
+            ssize_t l = ::pread(fd, data, size, offset);
+            if (l < 0 && errno == EINTR) continue;
+            if (l <= 0)
+            {
+                if (l == 0) errno = EIO;
+                return false;
+            }
+            data += l;
+            size -= l;
+            offset += l;
+        }
+        return true;
+    }
+
+
+    std::string IIgs::AppleDoublePath(const char *path)
+    {
+        std::string s(path);
+        std::string::size_type pos = s.rfind('/');
+
+        if (pos == std::string::npos) return "._" + s;
+
+        return s.substr(0, pos + 1) + "._" + s.substr(pos + 1);
+    }
+
+
+    bool IIgs::ParseAppleDouble(const uint8_t *header, unsigned length, unsigned *offset, unsigned *size)
+    {
+        /*
+         * AppleDouble Header (big endian):
+         * 0 uint32_t magic (0x00051607)
+         * 4 uint32_t version
+         * 8 uint8_t[16] filler
+         * 24 uint16_t number of entries
+         * 26 { uint32_t id, uint32_t offset, uint32_t length }[entries]
+         */
+
+        if (header == NULL || length < 26) return false;
+        if (read32be(header) != AppleDoubleMagic) return false;
+
+        // only scan the entries that were read.
+        unsigned count = read16be(header + 24);
+        if (count > (length - 26) / 12) count = (length - 26) / 12;
+
+        const uint8_t *cp = header + 26;
+        for (unsigned i = 0; i < count; ++i, cp += 12)
+        {
+            if (read32be(cp) == AppleDoubleResourceFork)
+            {
+                *offset = read32be(cp + 4);
+                *size = read32be(cp + 8);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    static uint8_t *ReadAppleDouble(const char *path, unsigned *length)
+    {
+        std::string adPath = AppleDoublePath(path);
+
+        int fd = ::open(adPath.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+
+        // 26 byte header + room for 10 entries.  The resource fork entry is
+        // normally among the first few; any past that aren't scanned.
+        uint8_t header[26 + 12 * 10];
+        unsigned offset;
+        unsigned size;
+        uint8_t *data = NULL;
+        struct stat st;
+
+        ssize_t l = ::pread(fd, header, sizeof(header), 0);
+        if (l < 0) goto fail;
+
+        if (!ParseAppleDouble(header, l, &offset, &size))
+        {
+            errno = ENOENT;
+            goto fail;
+        }
+
+        // a corrupt entry mustn't make us allocate more than the file holds.
+        if (::fstat(fd, &st) < 0) goto fail;
+        if ((uint64_t)offset + size > (uint64_t)st.st_size)
+        {
+            errno = EIO;
+            goto fail;
+        }
+
+        data = new uint8_t[size ? size : 1];
+        if (!ReadAt(fd, data, size, offset)) goto fail;
+
+        ::close(fd);
+        *length = size;
+        return data;
+
+    fail:
+        int e = errno;
+        delete[] data;
+        ::close(fd);
+        errno = e;
+        return NULL;
+    }
+
+
+    uint8_t *IIgs::ReadResourceFork(const char *path, unsigned *length, unsigned options)
+    {
+        if (path == NULL || length == NULL)
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        *length = 0;
+
+        if (options & rfRaw) return ReadFile(path, length);
+        if (options & rfAppleDouble) return ReadAppleDouble(path, length);
+
+        ssize_t size = xgetxattr(path, ResourceForkXattr, NULL, 0);
+        if (size < 0) return NULL;
+
+        uint8_t *data = new uint8_t[size ? size : 1];
+
+        if (size != xgetxattr(path, ResourceForkXattr, data, size))
+        {
+            delete[] data;
+            errno = EIO;
+            return NULL;
+        }
+
+        *length = size;
+        return data;
+    }
@@ -0,0 +1,64 @@
+/*
+ *  ResourceFork.h
+ *  IIgsResource
+ *
+ */
+
+#ifndef __PRODOS_RESOURCE_FORK_H__
+#define __PRODOS_RESOURCE_FORK_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include <string>
+
+namespace IIgs {
+
+    enum {
+        rfRaw           = 1,        // the file itself is the resource fork
+        rfAppleDouble   = 2         // read the fork from the AppleDouble ._file
+    };
+
+    // extended attribute holding the fork ("prodos.ResourceFork", or "user.prodos.ResourceFork" on linux).
+    extern const char *ResourceForkXattr;
+
+    enum {
+        AppleDoubleMagic            = 0x00051607,
+        AppleDoubleResourceFork     = 2         // entry id
+    };
+
+    /*
+     * Reads the resource fork of a file (the prodos.ResourceFork extended attribute).
+     * The returned buffer is allocated with new[], so it can be handed to
+     * ResourceManager with rmDelete.
+     *
+     * returns NULL on error (errno is set).
+     */
+    uint8_t *ReadResourceFork(const char *path, unsigned *length, unsigned options = 0);
+
+
+    /*
+     * read/write exactly size bytes, retrying after EINTR.  return false on error
+     * (errno is set; EIO if the file or socket ends early).
+     */
+    bool ReadAll(int fd, void *buffer, unsigned size);
+    bool WriteAll(int fd, const void *buffer, unsigned size);
+
+
+    // path of the AppleDouble header file for path (dir/._name).
+    std::string AppleDoublePath(const char *path);
+
+    /*
+     * Finds the resource fork entry in an AppleDouble header.  Only the entries
+     * that fit in length bytes are scanned, so a partial header (eg, the first
+     * 26 + 12 * 10 bytes) is fine.
+     *
+     * returns false if the header is invalid or there is no resource fork.
+     */
+    bool ParseAppleDouble(const uint8_t *header, unsigned length, unsigned *offset, unsigned *size);
+
+} // namespace
+
+#endif
+
+#endif
@@ -8,13 +8,17 @@
  */
 
 #include "ResourceManager.h"
+#include "ResourceConverter.h"
+#include "ResourceCache.h"
 
 
 
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 
 #include <algorithm>
+#include <new>
 
 using namespace IIgs;
 
@@ -31,17 +35,21 @@ using namespace IIgs;
     
     const static ResourceRecord InvalidRecord = { 0, 0, 0, 0, 0, -1 };
         
-    typedef std::vector<ResourceRecord>::iterator ResourceRecordIter;
-    typedef std::vector<ResType>::iterator ResTypeIter;
-    
-    
-    static bool Sort(const ResourceRecord& a, const ResourceRecord& b)
+    static bool TypeLess(const ResourceRecord& r, ResType resType)
     {
-        if (a.resType == b.resType) return a.resID < b.resID;
-        
-        return a.resType < b.resType;
+        return r.resType < resType;
     }
-    
+
+    static bool TypeGreater(ResType resType, const ResourceRecord& r)
+    {
+        return resType < r.resType;
+    }
+
+    static bool RecordLess(const ResourceRecord& r, ResID resID)
+    {
+        return r.resID < resID;
+    }
+
     static inline unsigned read16(const uint8_t *x)
     {
         return x[0] | (x[1] << 8);
@@ -54,12 +62,251 @@ using namespace IIgs;
 
     
     
+    static inline uint64_t Key(const ResourceRecord& r)
+    {
+        return ((uint64_t)r.resType << 32) | r.resID;
+    }
+
+
+    /*
+     * sort by type and resource ID.
+     *
+     * Most forks are already sorted, so check that first.  Small maps use
+     * an insertion sort; larger ones an LSD radix sort on the 48-bit (type, id)
+     * key, skipping any byte that is the same for every record.
+     *
+     * tmp must have room for count records; it's only used for the radix sort.
+     */
+    static bool IsSorted(const ResourceRecord *records, unsigned count)
+    {
+        for (unsigned i = 1; i < count; ++i)
+        {
+            if (Key(records[i - 1]) > Key(records[i])) return false;
+        }
+        return true;
+    }
+
+    static void InsertionSort(ResourceRecord *records, unsigned count)
+    {
+        for (unsigned i = 1; i < count; ++i)
+        {
+            ResourceRecord r = records[i];
+            uint64_t k = Key(r);
+            unsigned j = i;
+
+            for (; j > 0 && Key(records[j - 1]) > k; --j)
+                records[j] = records[j - 1];
+
+            records[j] = r;
+        }
+    }
+
+    static void RadixSort(ResourceRecord *records, unsigned count, ResourceRecord *tmp)
+    {
+        enum { Digits = 6 };
+
+        unsigned histogram[Digits][256];
+        std::memset(histogram, 0, sizeof(histogram));
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            uint64_t k = Key(records[i]);
+            for (unsigned d = 0; d < Digits; ++d)
+                ++histogram[d][(k >> (d * 8)) & 0xff];
+        }
+
+        ResourceRecord *src = records;
+        ResourceRecord *dest = tmp;
+
+        for (unsigned d = 0; d < Digits; ++d)
+        {
+            unsigned *h = histogram[d];
+            unsigned shift = d * 8;
+
+            // every key has the same digit -- nothing to do.
+            if (h[(Key(src[0]) >> shift) & 0xff] == count) continue;
+
+            unsigned offset = 0;
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                unsigned n = h[i];
+                h[i] = offset;
+                offset += n;
+            }
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                unsigned digit = (Key(src[i]) >> shift) & 0xff;
+                dest[h[digit]++] = src[i];
+            }
+
+            std::swap(src, dest);
+        }
+
+        if (src != records)
+            std::memcpy(records, src, count * sizeof(ResourceRecord));
+    }
+
+
+#pragma mark ResourceArena
+
+    ResourceArena::ResourceArena(unsigned size)
+    {
+        _blocks = NULL;
+
+        if (size)
+        {
+            allocate(size);
+            _blocks->used = 0;
+        }
+    }
+
+    ResourceArena::~ResourceArena()
+    {
+        while (_blocks)
+        {
+            Block *next = _blocks->next;
+            delete[] (uint8_t *)_blocks;
+            _blocks = next;
+        }
+    }
+
+    void *ResourceArena::allocate(unsigned size)
+    {
+        const unsigned header = (sizeof(Block) + 7) & ~7;
+        const unsigned limit = UINT_MAX - header;
+
+        // the rounding and the block size below must not wrap.
+        if (size > limit - 7) throw std::bad_alloc();
+
+        size = (size + 7) & ~7;
+
+        if (!_blocks || _blocks->size - _blocks->used < size)
+        {
+            unsigned capacity = 4096;
+            if (_blocks) capacity = _blocks->size > limit / 2 ? limit : _blocks->size * 2;
+            if (capacity < size) capacity = size;
+
+            Block *b = (Block *)new uint8_t[header + capacity];
+            b->next = _blocks;
+            b->size = capacity;
+            b->used = 0;
+            _blocks = b;
+        }
+
+        void *p = (uint8_t *)_blocks + header + _blocks->used;
+        _blocks->used += size;
+        return p;
+    }
+
+    void ResourceArena::reset()
+    {
+        if (!_blocks) return;
+
+        // merge into a single block so the next round doesn't need to grow.
+        if (_blocks->next)
+        {
+            unsigned total = capacity();
+
+            while (_blocks)
+            {
+                Block *next = _blocks->next;
+                delete[] (uint8_t *)_blocks;
+                _blocks = next;
+            }
+
+            allocate(total);
+        }
+
+        _blocks->used = 0;
+    }
+
+    unsigned ResourceArena::capacity() const
+    {
+        unsigned total = 0;
+        for (Block *b = _blocks; b; b = b->next)
+            total += b->size;
+        return total;
+    }
+
+
+#pragma mark ResourceManager
+
     ResourceManager::ResourceManager(const uint8_t *data, unsigned length, unsigned options)
     {
+        init(data, length, NULL, options);
+        open();
+    }
+
+    ResourceManager::ResourceManager(const uint8_t *data, unsigned length, unsigned options, ResourceArena *arena)
+    {
+        init(data, length, arena, options);
+        open();
+    }
+
+    ResourceManager::ResourceManager(const uint8_t *data, unsigned length, const ResourceRecord *records, unsigned count,
+        const ResType *types, unsigned typeCount, unsigned options)
+    {
+        init(data, length, NULL, options);
+
+        if (_data == NULL || (count && (records == NULL || types == NULL)))
+        {
+            setError(resBadFormat);
+            return;
+        }
+
+        // the index may come from somewhere less trusted than the map, so check it like open() does.
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const ResourceRecord& r = records[i];
+
+            if (r.resType == 0 || r.resID == 0 || r.resOffset > length || r.resSize > length - r.resOffset
+                || (i && Key(records[i - 1]) > Key(r)))
+            {
+                setError(resBadFormat);
+                return;
+            }
+        }
+
+        // never written to.
+        _resources = const_cast<ResourceRecord *>(records);
+        _resourceCount = count;
+        _types = const_cast<ResType *>(types);
+        _typeCount = typeCount;
+        _ownIndex = false;
+    }
+
+    void ResourceManager::init(const uint8_t *data, unsigned length, ResourceArena *arena, unsigned options)
+    {
+        _types = NULL;
+        _typeCount = 0;
+        _resources = NULL;
+        _resourceCount = 0;
+        _arena = arena;
+        _ownIndex = true;
+
+        _converters = NULL;
+        _cache = NULL;
+
+        static uint32_t Serial = 0;
+        _serial = __sync_add_and_fetch(&Serial, 1);
+
         if (options & rmCopy)
         {
-            options |= rmDelete;
-            uint8_t *tmp = new uint8_t[length];
+            uint8_t *tmp;
+
+            if (arena)
+            {
+                // owned by the arena.
+                options &= ~(rmDelete | rmFree);
+                tmp = (uint8_t *)arena->allocate(length);
+            }
+            else
+            {
+                options |= rmDelete;
+                tmp = new uint8_t[length];
+            }
+
             std::memcpy(tmp, data, length);
             data = tmp;
         }
@@ -73,18 +320,43 @@ using namespace IIgs;
         _length = length;
         _options = options;
         _error = 0;
-        
-        open();
     }
     
     
     ResourceManager::~ResourceManager()
     {
+        setCache(NULL);
+        close();
+
         if (_options & rmFree) { if (_data) std::free((void *)_data); }
         if (_options & rmDelete) delete[] _data;
     }
 
     
+    void *ResourceManager::allocate(unsigned size)
+    {
+        if (_arena) return _arena->allocate(size);
+
+        void *p = std::malloc(size ? size : 1);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    void ResourceManager::close()
+    {
+        if (!_arena && _ownIndex)
+        {
+            std::free(_resources);
+            std::free(_types);
+        }
+
+        _resources = NULL;
+        _resourceCount = 0;
+        _types = NULL;
+        _typeCount = 0;
+    }
+
+    
     void ResourceManager::setError(unsigned error)
     {
         _error = error;
@@ -94,8 +366,7 @@ using namespace IIgs;
         }
     }
     
-    // parse the data...
-    void ResourceManager::open()
+    unsigned ResourceManager::probe(const uint8_t *header, const uint8_t *mapHeader, unsigned length, ResourceProbe *probe)
     {
         /*
          * File Header:
@@ -103,25 +374,31 @@ using namespace IIgs;
          * 4 uint32_t rFileToMap
          * 8 uint32_t rFileMapSize
          */
-        
-        if (_data == NULL || _length < 16)
-        {
-            setError(resBadFormat);
-            return;
-        }
 
-        
-        unsigned rFileVersion = read32(_data);
-        unsigned rFileToMap = read32(_data + 4);
-        unsigned rFileMapSize = read32(_data + 8);
-        
-        if (rFileVersion != 0 || _length < rFileToMap + rFileMapSize || rFileMapSize < 30)
+        ResourceProbe tmp;
+        if (probe == NULL) probe = &tmp;
+
+        std::memset(probe, 0, sizeof(ResourceProbe));
+        probe->error = resBadFormat;
+
+        if (header == NULL || length < 16) return resBadFormat;
+
+        unsigned rFileVersion = read32(header);
+        unsigned rFileToMap = read32(header + 4);
+        unsigned rFileMapSize = read32(header + 8);
+
+        if (rFileVersion != 0 || rFileToMap > length || rFileMapSize > length - rFileToMap || rFileMapSize < 30)
+            return resBadFormat;
+
+        probe->mapOffset = rFileToMap;
+        probe->mapSize = rFileMapSize;
+
+        if (mapHeader == NULL)
         {
-            setError(resBadFormat);
-            return;
+            probe->error = 0;
+            return 0;
         }
 
-        
         /*
          * Resource Map Header:
          *
@@ -138,36 +415,87 @@ using namespace IIgs;
          * 30 uint16_t map free list used
          */
 
-        const uint8_t *cp = _data + rFileToMap;
-        
+        const uint8_t *cp = mapHeader;
+
         //verify numbers are consistent.
-        if ((rFileToMap != read32(cp + 6)) || (rFileMapSize != read32(cp + 10))) 
-        {
-            setError(resBadFormat);
-            return;
-        }
-        
+        if ((rFileToMap != read32(cp + 6)) || (rFileMapSize != read32(cp + 10)))
+            return resBadFormat;
+
         unsigned mapIndex = read16(cp + 14);
         unsigned mapIndexSize = read32(cp + 20);
-        unsigned mapIndexUsed = read32(cp + 24);        
-        
+        unsigned mapIndexUsed = read32(cp + 24);
+
         // verify enough space for map index.
-        if (_length < rFileToMap + mapIndex + mapIndexSize * 20)
+        unsigned available = length - rFileToMap;
+        if (mapIndex > available || mapIndexSize > (available - mapIndex) / 20 || mapIndexUsed > mapIndexSize)
+            return resBadFormat;
+
+        probe->indexOffset = rFileToMap + mapIndex;
+        probe->indexSize = mapIndexSize;
+        probe->count = mapIndexUsed;
+        probe->error = 0;
+        return 0;
+    }
+
+    unsigned ResourceManager::probe(const uint8_t *data, unsigned length, ResourceProbe *probe)
+    {
+        ResourceProbe tmp;
+        if (probe == NULL) probe = &tmp;
+
+        unsigned error = ResourceManager::probe(data, NULL, length, probe);
+        if (error) return error;
+
+        // the map header is validated against the length, so this is in range.
+        return ResourceManager::probe(data, data + probe->mapOffset, length, probe);
+    }
+
+    unsigned ResourceManager::probe(unsigned count, const uint8_t * const *headers, const uint8_t * const *mapHeaders,
+        const unsigned *lengths, ResourceProbe *probes)
+    {
+        unsigned valid = 0;
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (!probe(headers[i], mapHeaders ? mapHeaders[i] : NULL, lengths[i], probes + i))
+                ++valid;
+        }
+
+        return valid;
+    }
+
+
+    // parse the data...
+    void ResourceManager::open()
+    {
+        ResourceProbe p;
+
+        if (_data == NULL || probe(_data, _length, &p))
         {
             setError(resBadFormat);
             return;
         }
-        
+
+        unsigned mapIndexUsed = p.count;
+
         // build the indexes....
         
-        _resources.reserve(mapIndexUsed);
-        
+        if (mapIndexUsed == 0) return;
 
-        cp = _data + rFileToMap + mapIndex;
+        // allocate() takes an unsigned size.
+        if (mapIndexUsed > UINT_MAX / sizeof(ResourceRecord))
+        {
+            setError(resBadFormat);
+            return;
+        }
+
+        ResourceRecord *records = (ResourceRecord *)allocate(mapIndexUsed * sizeof(ResourceRecord));
+        _resources = records;
+
+        const uint8_t *cp = _data + p.indexOffset;
         
         for (unsigned i = 0; i < mapIndexUsed; ++i)
         {
-            ResourceRecord r;
+            ResourceRecord& r = records[i];
             
             r.resType = read16(cp);
             cp += 2;
@@ -189,39 +517,61 @@ using namespace IIgs;
             
             if (r.resType == 0 || r.resID == 0)
             {
+                close();
                 setError(resInvalidTypeOrID);
                 return;
             }
             
-            if (r.resOffset + r.resSize > _length)
+            if (r.resOffset > _length || r.resSize > _length - r.resOffset)
             {
+                close();
                 setError(resBadFormat);
                 return;                
             }
-            
-            _resources.push_back(r);
         }    
         
         // sort by type and resource ID.
-        std::sort(_resources.begin(), _resources.end(), Sort);
+        if (!IsSorted(records, mapIndexUsed))
+        {
+            if (mapIndexUsed < 32)
+            {
+                InsertionSort(records, mapIndexUsed);
+            }
+            else
+            {
+                ResourceRecord *tmp = (ResourceRecord *)allocate(mapIndexUsed * sizeof(ResourceRecord));
+                RadixSort(records, mapIndexUsed, tmp);
+                if (!_arena) std::free(tmp);
+            }
+        }
         
         // build the type list
         
-        if (!_resources.empty())
+        unsigned typeCount = 0;
+        ResType t = 0;
+        for (unsigned i = 0; i < mapIndexUsed; ++i)
         {
-            ResType t = 0;
-            for (unsigned i = 0; i < _resources.size(); ++i)
+            ResourceRecord& r = records[i];
+            r.resIndex = i;
+            if (r.resType != t)
             {
-                ResourceRecord& r = _resources[i];
-                r.resIndex = i;
-                if (r.resType != t)
-                {
-                    _types.push_back(t = r.resType);
-                }
+                t = r.resType;
+                ++typeCount;
             }
-            
         }
 
+        _types = (ResType *)allocate(typeCount * sizeof(ResType));
+
+        t = 0;
+        for (unsigned i = 0; i < mapIndexUsed; ++i)
+        {
+            if (records[i].resType != t)
+            {
+                _types[_typeCount++] = t = records[i].resType;
+            }
+        }
+
+        _resourceCount = mapIndexUsed;
     }    
 
     ResType ResourceManager::getIndexedType(unsigned index)
@@ -237,6 +587,18 @@ using namespace IIgs;
     }
     
     
+    RecordRange ResourceManager::resources(ResType resType) const
+    {
+        const ResourceRecord *begin = _resources;
+        const ResourceRecord *end = _resources + _resourceCount;
+
+        begin = std::lower_bound(begin, end, resType, TypeLess);
+        end = std::upper_bound(begin, end, resType, TypeGreater);
+
+        return RecordRange(begin, end);
+    }
+
+
     ResID ResourceManager::getIndexedResource(ResType resType, unsigned index)
     {
         if (resType == 0) 
@@ -245,19 +607,11 @@ using namespace IIgs;
             return 0;
         }        
         
-        for (ResourceRecordIter iter = _resources.begin(); iter != _resources.end(); ++iter)
+        RecordRange range = resources(resType);
+        if (index < range.size())
         {
-            if (iter->resType == resType)
-            {
-                if (index == 0)
-                {
-                    _error = 0;
-                    return iter->resID;
-                }
-                --index;
-                continue;
-            }
-            if (iter->resType > resType) break;
+            _error = 0;
+            return range[index].resID;
         }
         
         setError(resIndexRange);
@@ -299,14 +653,13 @@ using namespace IIgs;
             return InvalidRecord;
         }        
         
-        for (ResourceRecordIter iter = _resources.begin(); iter != _resources.end(); ++iter)
+        RecordRange range = resources(resType);
+        const ResourceRecord *iter = std::lower_bound(range.begin(), range.end(), resID, RecordLess);
+
+        if (iter != range.end() && iter->resID == resID)
         {
-            if (iter->resType == resType && iter->resID == resID)
-            {
-                _error = 0;
-                return *iter;
-            }
-            if (iter->resType > resType) break;
+            _error = 0;
+            return *iter;
         }
     
         setError(resNotFound);
@@ -333,6 +686,49 @@ using namespace IIgs;
 
     
     
+#pragma mark ConvertedResources
+
+    void ResourceManager::setCache(ResourceCache *cache)
+    {
+        if (_cache && _cache != cache) _cache->purge(_serial);
+        _cache = cache;
+    }
+
+    ConvertedResource *ResourceManager::loadConvertedResource(ResType resType, ResID resID)
+    {
+        ResourceRecord r = getResourceRecord(resType, resID);
+        if (_error) return NULL;
+
+        ResourceConverter *converter = _converters ? _converters->converter(resType) : NULL;
+        if (!converter)
+        {
+            setError(resNoConverter);
+            return NULL;
+        }
+
+        ConvertedResource *object = _cache ? _cache->lookup(_serial, resType, resID) : NULL;
+        if (object) return object;
+
+        unsigned error = 0;
+        object = converter->convert(resType, resID, _data + r.resOffset, r.resSize, &error);
+        if (!object)
+        {
+            setError(error ? error : (unsigned)resBadFormat);
+            return NULL;
+        }
+
+        if (_cache)
+        {
+            ConvertedResource *cached = _cache->insert(_serial, resType, resID, object);
+            object->release();
+            object = cached;
+        }
+
+        _error = 0;
+        return object;
+    }
+
+
 #pragma mark NamedResources
     
     ResID ResourceManager::findNamedResource(ResType resType, const std::string& name)
@@ -358,79 +754,131 @@ using namespace IIgs;
     }
 
     
-    std::string ResourceManager::getResourceName(ResType resType, ResID resID)
+    /*
+     * rResName ($10000 + type):
+     *
+     * uint16_t version
+     * uint32_t count
+     * [0..count-1] { uint32_t id, pstring name }
+     *
+     * returns the resource data (entries start at offset 6), or NULL and sets the error.
+     */
+    const uint8_t *ResourceManager::nameList(ResType resType, unsigned *size, unsigned *count)
     {
-        
-        if (resType == 0 || resID == 0) 
-        {
-            setError(resInvalidTypeOrID); 
-            return "";
-        }
-        
-        
         std::pair<const uint8_t *, unsigned> nameRec = loadResource(rResName, resNameOffset + resType);
-        
-        if (_error)
-        {
-            return "";
-        }
-        
+        if (_error) return NULL;
 
-        
-        /*
-         * uint16_t version
-         * uint32_t count
-         * [0..count-1] { uint32_t id, pstring name }
-         */
-        
-        unsigned size = nameRec.second;
-        const uint8_t *data = nameRec.first;
-        unsigned offset = 0;
-        unsigned count;
-        
-        
-        if (size < 6)
+        if (nameRec.second < 6)
         {
             setError(resNameNotFound);
-            return 0;
+            return NULL;
         }
-        
-        if (resNameVersion != read16(data))
+
+        if (resNameVersion != read16(nameRec.first))
         {
             setError(resBadNameVers);
-            return 0;
+            return NULL;
         }
+
+        *size = nameRec.second;
+        *count = read32(nameRec.first + 2);
+        return nameRec.first;
+    }
+
+    // reads the entry at offset and advances past it; false if it's truncated.
+    static bool NextName(const uint8_t *data, unsigned size, unsigned& offset, ResID& resID,
+        const uint8_t *&name, unsigned& length)
+    {
+        // must have space for uint32_t + length byte.
+        if (offset > size || size - offset < 5) return false;
+
+        resID = read32(data + offset);
+        length = data[offset + 4];
+        offset += 5;
+
+        if (length > size - offset) return false;
+
+        name = data + offset;
+        offset += length;
+        return true;
+    }
+
+    static bool NameLess(const std::pair<ResID, std::string>& a, const std::pair<ResID, std::string>& b)
+    {
+        return a.first < b.first;
+    }
+
+    
+    std::string ResourceManager::getResourceName(ResType resType, ResID resID)
+    {
         
-        offset += 2;
+        if (resType == 0 || resID == 0) 
+        {
+            setError(resInvalidTypeOrID); 
+            return "";
+        }
         
-        count = read32(data + offset);
-        offset += 4;
+        unsigned size;
+        unsigned count;
+        const uint8_t *data = nameList(resType, &size, &count);
+        if (!data) return "";
+
+        unsigned offset = 6;
         
         for (unsigned i = 0; i < count; ++i)
         {
-            // must have space for uint32_t + length byte.
-            if (offset + 5 >= size) break;
-            
-            ResID rID = read32(data + offset);
-            offset += 4;
-            
-            unsigned l = data[offset];
-            offset += 1;
-            if (offset + l >= size) break;
+            ResID rID;
+            const uint8_t *name;
+            unsigned l;
+
+            if (!NextName(data, size, offset, rID, name, l)) break;
 
             if (resID == rID)
             {
                 _error = 0;
-                return std::string((const char *)(data + offset), l);
+                return std::string((const char *)name, l);
             }
-            
-            
         }
      
         
         setError(resNameNotFound);
         return "";
     }
+
+    std::vector<std::pair<ResID, std::string> > ResourceManager::getResourceNames(ResType resType)
+    {
+        std::vector<std::pair<ResID, std::string> > names;
+
+        if (resType == 0)
+        {
+            setError(resInvalidTypeOrID);
+            return names;
+        }
+
+        unsigned size;
+        unsigned count;
+        const uint8_t *data = nameList(resType, &size, &count);
+        if (!data) return names;
+
+        unsigned offset = 6;
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            ResID rID;
+            const uint8_t *name;
+            unsigned l;
+
+            if (!NextName(data, size, offset, rID, name, l)) break;
+
+            names.push_back(std::make_pair(rID, std::string((const char *)name, l)));
+        }
+
+        // usually already in order; stable so the first of any duplicates wins, like getResourceName.
+        std::stable_sort(names.begin(), names.end(), NameLess);
+
+        _error = 0;
+        return names;
+    }
     
     ResID ResourceManager::findNamedResource(ResType resType, const char *name, unsigned nameLength)
     {
@@ -446,61 +894,23 @@ using namespace IIgs;
             return 0;            
         }
         
-
-        std::pair<const uint8_t *, unsigned> nameRec = loadResource(rResName, resNameOffset + resType);
-        if (_error)
-        {
-            return 0;
-        }
-        
-        /*
-         * uint16_t version
-         * uint32_t count
-         * [0..count-1] { uint32_t id, pstring name }
-         */
-        
-        unsigned size = nameRec.second;
-        const uint8_t *data = nameRec.first;
-        unsigned offset = 0;
+        unsigned size;
         unsigned count;
-        
-        
-        if (size < 6)
-        {
-            setError(resNameNotFound);
-            return 0;
-        }
-        
-        if (resNameVersion != read16(data))
-        {
-            setError(resBadNameVers);
-            return 0;
-        }
-        
-        offset += 2;
-        
-        count = read32(data + offset);
-        offset += 4;
+        const uint8_t *data = nameList(resType, &size, &count);
+        if (!data) return 0;
+
+        unsigned offset = 6;
         
         for (unsigned i = 0; i < count; ++i)
         {
-            // must have space for uint32_t + length byte.
-            if (offset + 5 >= size) break;
-            
-            ResID rID = read32(data + offset);
-            offset += 4;
-            
-            unsigned l = data[offset];
-            offset += 1;
-            if (offset + l >= size) break;
-            
-            if (l != nameLength)
-            {
-                offset += l;
-                continue;
-            }
+            ResID rID;
+            const uint8_t *n;
+            unsigned l;
 
-            if (std::strcmp((const char *)data + offset, name) == 0)
+            if (!NextName(data, size, offset, rID, n, l)) break;
+            
+            // names are pstrings -- not 0-terminated.
+            if (l == nameLength && std::memcmp(n, name, l) == 0)
             {
                 _error = 0;
                 return rID;
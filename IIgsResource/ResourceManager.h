@@ -15,6 +15,8 @@
 #include <vector>
 #include <utility>
 #include <string>
+#include <iterator>
+#include <cstddef>
 
 namespace IIgs {
 #endif
@@ -145,6 +147,18 @@ namespace IIgs {
 #endif
     } ResourceRecord;
 
+
+    /*
+     * Result of ResourceManager::probe -- the map extent, as read from the file and map headers.
+     */
+    typedef struct ResourceProbe {
+        unsigned    error;
+        unsigned    mapOffset;      /* rFileToMap */
+        unsigned    mapSize;        /* rFileMapSize */
+        unsigned    indexOffset;    /* absolute offset of the map index */
+        unsigned    indexSize;      /* number of index entries */
+        unsigned    count;          /* number of index entries used (resources) */
+    } ResourceProbe;
     
 
     
@@ -158,19 +172,185 @@ namespace IIgs {
         rmDelete    = 4,        // use delete[] on the data
         rmThrow     = 8         // throw errors?
     };
-    
+
+
+    class ConverterRegistry;
+    class ConvertedResource;
+    class ResourceCache;
+
+
+    /*
+     * A simple bump allocator for the map index, so many forks can be opened
+     * without going through malloc each time.  Memory is only reclaimed by reset(),
+     * which must not be called while a ResourceManager using the arena is alive.
+     */
+    class ResourceArena {
+
+    public:
+
+        ResourceArena(unsigned size = 0);
+        ~ResourceArena();
+
+        void *allocate(unsigned size);
+        void reset();
+
+        unsigned capacity() const;
+
+    private:
+
+        ResourceArena(const ResourceArena&);
+        ResourceArena& operator=(const ResourceArena&);
+
+        struct Block {
+            Block *next;
+            unsigned size;
+            unsigned used;
+        };
+
+        Block *_blocks;
+    };
+
+
+    /*
+     * Ranges over the sorted index.  These are plain views -- they don't set error()
+     * so they can be shared between threads (eg, std::for_each(std::execution::par, ...)).
+     * They are invalidated when the ResourceManager is destroyed.
+     */
+    template<class T>
+    class IndexRange {
+
+    public:
+
+        typedef T value_type;
+        typedef const T *iterator;
+        typedef const T *const_iterator;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::size_t size_type;
+
+        IndexRange() : _begin(NULL), _end(NULL) {}
+        IndexRange(const T *begin, const T *end) : _begin(begin), _end(end) {}
+
+        iterator begin() const { return _begin; }
+        iterator end() const { return _end; }
+
+        size_type size() const { return _end - _begin; }
+        bool empty() const { return _begin == _end; }
+
+        const T& operator[](size_type index) const { return _begin[index]; }
+
+    private:
+        const T *_begin;
+        const T *_end;
+    };
+
+    typedef IndexRange<ResType> TypeRange;
+    typedef IndexRange<ResourceRecord> RecordRange;
+
+
+    // records where (resAttr & mask) == value.
+    class AttrIterator {
+
+    public:
+
+        typedef std::forward_iterator_tag iterator_category;
+        typedef ResourceRecord value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const ResourceRecord *pointer;
+        typedef const ResourceRecord& reference;
+
+        AttrIterator() : _iter(NULL), _end(NULL), _mask(0), _value(0) {}
+        AttrIterator(const ResourceRecord *iter, const ResourceRecord *end, ResAttr mask, ResAttr value) :
+            _iter(iter), _end(end), _mask(mask), _value(value)
+        {
+            skip();
+        }
+
+        reference operator*() const { return *_iter; }
+        pointer operator->() const { return _iter; }
+
+        AttrIterator& operator++() { ++_iter; skip(); return *this; }
+        AttrIterator operator++(int) { AttrIterator tmp(*this); ++*this; return tmp; }
+
+        bool operator==(const AttrIterator& rhs) const { return _iter == rhs._iter; }
+        bool operator!=(const AttrIterator& rhs) const { return _iter != rhs._iter; }
+
+    private:
+
+        void skip()
+        {
+            while (_iter != _end && (_iter->resAttr & _mask) != _value) ++_iter;
+        }
+
+        const ResourceRecord *_iter;
+        const ResourceRecord *_end;
+        ResAttr _mask;
+        ResAttr _value;
+    };
+
+    class AttrRange {
+
+    public:
+
+        typedef ResourceRecord value_type;
+        typedef AttrIterator iterator;
+        typedef AttrIterator const_iterator;
+
+        AttrRange(const ResourceRecord *begin, const ResourceRecord *end, ResAttr mask, ResAttr value) :
+            _begin(begin, end, mask, value), _end(end, end, mask, value)
+        {}
+
+        iterator begin() const { return _begin; }
+        iterator end() const { return _end; }
+
+        bool empty() const { return _begin == _end; }
+
+    private:
+        AttrIterator _begin;
+        AttrIterator _end;
+    };
+
+
     class ResourceManager {
 
     public:
         
         ResourceManager(const uint8_t *data, unsigned length, unsigned options = 0);
+        // the index (and rmCopy data) come from arena, which must outlive the ResourceManager.
+        ResourceManager(const uint8_t *data, unsigned length, unsigned options, ResourceArena *arena);
+
+        /*
+         * Use an index that was already built (eg, by another ResourceManager, via
+         * resources() and types()) instead of parsing the map.  records must be sorted
+         * and, like types, outlive the ResourceManager; neither is copied or freed.
+         * The records are checked against length (resBadFormat if they don't fit).
+         */
+        ResourceManager(const uint8_t *data, unsigned length, const ResourceRecord *records, unsigned count,
+            const ResType *types, unsigned typeCount, unsigned options = 0);
+
         ~ResourceManager();
+
+        /*
+         * Validate a fork without parsing the map index.
+         *
+         * header is the 16-byte file header, mapHeader is the 32-byte map header
+         * (at probe->mapOffset) and length is the total fork length.  If mapHeader
+         * is NULL, only the file header is checked and mapOffset/mapSize are filled in
+         * so the caller knows where to read the map header from.
+         *
+         * returns 0 or an error code (also stored in probe->error).
+         */
+        static unsigned probe(const uint8_t *header, const uint8_t *mapHeader, unsigned length, ResourceProbe *probe);
+        static unsigned probe(const uint8_t *data, unsigned length, ResourceProbe *probe);
+
+        // batch version; returns the number of valid forks.
+        static unsigned probe(unsigned count, const uint8_t * const *headers, const uint8_t * const *mapHeaders,
+            const unsigned *lengths, ResourceProbe *probes);
         
         unsigned error() const { return _error; }
         
         
-        unsigned countTypes() { _error = 0; return _types.size(); }
-        unsigned countResources() { _error = 0; return _resources.size(); }
+        unsigned countTypes() { _error = 0; return _typeCount; }
+        unsigned countResources() { _error = 0; return _resourceCount; }
         
         ResType getIndexedType(unsigned index);
         ResID getIndexedResource(ResType resType, unsigned index);
@@ -184,25 +364,78 @@ namespace IIgs {
 
         
         std::pair<const uint8_t *, unsigned> loadResource(ResType resType, ResID resID);
+
+
+        TypeRange types() const { return TypeRange(_types, _types + _typeCount); }
+        RecordRange resources() const { return RecordRange(_resources, _resources + _resourceCount); }
+        RecordRange resources(ResType resType) const;
+
+        // all attr bits in mask set, or (resAttr & mask) == value.
+        AttrRange resourcesWithAttr(ResAttr mask) const { return resourcesWithAttr(mask, mask); }
+        AttrRange resourcesWithAttr(ResAttr mask, ResAttr value) const
+        {
+            return AttrRange(_resources, _resources + _resourceCount, mask, value);
+        }
+
+        // data for a record from one of the ranges above.
+        const uint8_t *resourceData(const ResourceRecord& r) const { return _data + r.resOffset; }
         
         ResID findNamedResource(ResType resType, const std::string& name);
         ResID findNamedResource(ResType resType, const char * name);
 
         std::string getResourceName(ResType resType, ResID resID);
 
+        // all the names for a type (from its rResName resource), sorted by id.
+        std::vector<std::pair<ResID, std::string> > getResourceNames(ResType resType);
+
         std::pair<const uint8_t *, unsigned> loadNamedResource(ResType resType, const std::string& name);
         std::pair<const uint8_t *, unsigned> loadNamedResource(ResType resType, const char* name);
+
+
+        /*
+         * Converted resources.  The registry and cache are owned by the caller and
+         * may be shared between forks.  Both must outlive the ResourceManager --
+         * the destructor purges this fork from the cache (or call setCache(NULL)
+         * first).  loadConvertedResource returns a retained
+         * object (call release() when done); it fails with resNoConverter if no
+         * converter is logged in for the type.
+         */
+        void setConverters(ConverterRegistry *converters) { _converters = converters; }
+        void setCache(ResourceCache *cache);
+
+        ConvertedResource *loadConvertedResource(ResType resType, ResID resID);
+
+        // unique per ResourceManager, for cache keys.
+        uint32_t serial() const { return _serial; }
         
     private:
         
+        // not copyable -- the index is a raw array that may belong to an arena.
+        ResourceManager(const ResourceManager&);
+        ResourceManager& operator=(const ResourceManager&);
+
+        void init(const uint8_t *data, unsigned length, ResourceArena *arena, unsigned options);
         void open();
+        void close();
         void setError(unsigned error);
+
+        void *allocate(unsigned size);
         
         ResID findNamedResource(ResType resType, const char *name, unsigned nameLength);
+        const uint8_t *nameList(ResType resType, unsigned *size, unsigned *count);
         std::pair<const uint8_t *, unsigned> loadNamedResource(ResType resType, const char* name, unsigned nameLength);
         
-        std::vector<ResType>_types;
-        std::vector<ResourceRecord>_resources;
+        ResType *_types;
+        unsigned _typeCount;
+        ResourceRecord *_resources;
+        unsigned _resourceCount;
+        ResourceArena *_arena;
+        bool _ownIndex;
+
+        ConverterRegistry *_converters;
+        ResourceCache *_cache;
+        uint32_t _serial;
+
         const uint8_t *_data;
         unsigned _length;
         unsigned _options;
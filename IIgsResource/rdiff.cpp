@@ -0,0 +1,138 @@
+/*
+ *  rdiff.cpp
+ *  IIgsResource
+ *
+ *  Compare the resource maps of two files.
+ *
+ *  Output is one line per resource, tab separated:
+ *
+ *  op type id oldAttr oldOffset oldSize newAttr newOffset newSize
+ *
+ *  op is one of A (added), R (removed), C (changed), M (moved) or = (unchanged, with -a).
+ *  Numbers are hex; fields that don't apply are -.  To patch the old fork into the new one,
+ *  only the A and C ranges need to be read from the new fork; M bodies can be copied from
+ *  the old fork.
+ */
+
+#include "ResourceManager.h"
+#include "ResourceDiff.h"
+#include "ResourceFork.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+using namespace IIgs;
+
+static const char *progname = "rdiff";
+
+void usage(int exitCode)
+{
+    fprintf(exitCode == 0 ? stdout : stderr, "Usage: %s [-a] [-r] oldfile newfile\n", progname);
+    fprintf(exitCode == 0 ? stdout : stderr, "  -a  include unchanged resources\n");
+    fprintf(exitCode == 0 ? stdout : stderr, "  -r  files are raw resource forks\n");
+    exit(exitCode);
+}
+
+
+ResourceManager *load(const char *file, unsigned options)
+{
+    unsigned length;
+    uint8_t *data = ReadResourceFork(file, &length, options);
+
+    if (!data)
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+
+    ResourceManager *rm = new ResourceManager(data, length, rmDelete);
+    if (rm->error())
+    {
+        fprintf(stderr, "invalid resource file: ``%s''\n", file);
+        delete rm;
+        return NULL;
+    }
+
+    return rm;
+}
+
+
+void printRecord(const ResourceRecord& r)
+{
+    if (r.isValid())
+        printf("\t%04x\t%08x\t%08x", r.resAttr, r.resOffset, r.resSize);
+    else
+        printf("\t-\t-\t-");
+}
+
+
+int main(int argc, char **argv)
+{
+    static const char Ops[] = { '=', 'A', 'R', 'C', 'M' };
+
+    unsigned forkOptions = 0;
+    unsigned diffOptions = 0;
+    int c;
+
+    if (argc > 0) progname = argv[0];
+
+    while ((c = getopt(argc, argv, "arh")) != -1)
+    {
+        switch (c)
+        {
+            case 'a':
+                diffOptions |= rdIncludeUnchanged;
+                break;
+            case 'r':
+                forkOptions |= rfRaw;
+                break;
+            case 'h':
+                usage(0);
+                break;
+            default:
+                usage(1);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 2) usage(1);
+
+    ResourceManager *a = load(argv[0], forkOptions);
+    ResourceManager *b = a ? load(argv[1], forkOptions) : NULL;
+
+    if (!a || !b)
+    {
+        delete a;
+        exit(2);
+    }
+
+    std::vector<ResourceDelta> deltas;
+    DiffResources(*a, *b, deltas, diffOptions);
+
+    printf("# op\ttype\tid\toldAttr\toldOffset\toldSize\tnewAttr\tnewOffset\tnewSize\n");
+
+    for (std::vector<ResourceDelta>::iterator iter = deltas.begin(); iter != deltas.end(); ++iter)
+    {
+        printf("%c\t%04x\t%08x", Ops[iter->kind], iter->resType, iter->resID);
+        printRecord(iter->oldRecord);
+        printRecord(iter->newRecord);
+        printf("\n");
+    }
+
+    delete a;
+    delete b;
+
+    // like diff(1), 1 if there are differences.
+    for (std::vector<ResourceDelta>::iterator iter = deltas.begin(); iter != deltas.end(); ++iter)
+    {
+        if (iter->kind != rdUnchanged) exit(1);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,645 @@
+/*
+ *  rextract.cpp
+ *  IIgsResource
+ *
+ *  Extract every resource of every file.
+ *
+ *  Directory output: outdir/<file>/<type>/<id> (hex, like rlist) plus
+ *  outdir/<file>/index, one line per resource:  type id attr size name
+ *
+ *  Tar output (-t): the same layout as a single ustar archive.
+ *
+ *  Forks are read by ForkLoader, names are resolved on its worker threads and
+ *  a single writer thread writes the bodies straight out of the fork buffer.
+ *  A worker waits for its fork to be written before the buffer is released,
+ *  so at most (workers) forks are pending at a time.
+ */
+
+#include "ResourceManager.h"
+#include "ForkLoader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace IIgs;
+
+static const char *progname = "rextract";
+
+
+struct Item {
+    std::string name;       // relative to the fork directory
+    const uint8_t *data;
+    unsigned size;
+};
+
+struct Batch {
+    std::string dir;        // relative to the output
+    std::vector<std::string> subdirs;
+    std::vector<Item> items;
+    std::string index;
+    bool done;
+    bool failed;            // set by the writer if anything wasn't written
+};
+
+
+struct Stats {
+    unsigned forks;
+    unsigned failed;
+    unsigned files;
+    uint64_t bytes;
+};
+
+
+class Writer {
+
+public:
+
+    Writer(const char *output, bool tar);
+    ~Writer();
+
+    bool ok() const { return _fd >= 0; }
+
+    // a tar write failed -- the archive is incomplete.
+    bool broken() const { return _broken; }
+
+    // called on a ForkLoader worker; returns once the batch is written.
+    void write(Batch *batch);
+    void finish();
+
+    void *run();
+
+    Stats stats;
+
+private:
+
+    bool writeDirectory(Batch *batch);
+    bool writeTar(Batch *batch);
+    bool writeTarEntry(const std::string& name, const uint8_t *data, unsigned size);
+    bool append(const void *data, unsigned size);
+    bool flush();
+
+    bool makeDirectory(const std::string& path);
+
+    std::string _output;
+    bool _tar;
+    bool _broken;
+    int _fd;
+
+    std::set<std::string> _directories;
+
+    std::vector<uint8_t> _buffer;
+
+    // tar entries still in the buffer; counted once they're written.
+    Stats _pending;
+
+    std::deque<Batch *> _queue;
+    bool _closed;
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _queued;
+    pthread_cond_t _written;
+};
+
+
+Writer::Writer(const char *output, bool tar) : _output(output), _tar(tar), _broken(false), _closed(false)
+{
+    std::memset(&stats, 0, sizeof(stats));
+    std::memset(&_pending, 0, sizeof(_pending));
+
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_queued, NULL);
+    pthread_cond_init(&_written, NULL);
+
+    if (tar)
+    {
+        _fd = ::open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        _buffer.reserve(1 << 20);
+    }
+    else
+    {
+        if (::mkdir(output, 0777) < 0 && errno != EEXIST) _fd = -1;
+        else _fd = ::open(output, O_RDONLY | O_DIRECTORY);
+    }
+
+    if (_fd < 0) fprintf(stderr, "%s: %s\n", output, strerror(errno));
+}
+
+Writer::~Writer()
+{
+    if (_fd >= 0) ::close(_fd);
+
+    pthread_cond_destroy(&_written);
+    pthread_cond_destroy(&_queued);
+    pthread_mutex_destroy(&_lock);
+}
+
+
+void Writer::write(Batch *batch)
+{
+    pthread_mutex_lock(&_lock);
+
+    batch->done = false;
+    batch->failed = false;
+    _queue.push_back(batch);
+    pthread_cond_signal(&_queued);
+
+    while (!batch->done)
+        pthread_cond_wait(&_written, &_lock);
+
+    pthread_mutex_unlock(&_lock);
+}
+
+void Writer::finish()
+{
+    pthread_mutex_lock(&_lock);
+    _closed = true;
+    pthread_cond_signal(&_queued);
+    pthread_mutex_unlock(&_lock);
+}
+
+void *Writer::run()
+{
+    for(;;)
+    {
+        pthread_mutex_lock(&_lock);
+        while (_queue.empty() && !_closed)
+            pthread_cond_wait(&_queued, &_lock);
+
+        if (_queue.empty())
+        {
+            pthread_mutex_unlock(&_lock);
+            break;
+        }
+
+        Batch *batch = _queue.front();
+        _queue.pop_front();
+        pthread_mutex_unlock(&_lock);
+
+        bool ok = _tar ? writeTar(batch) : writeDirectory(batch);
+
+        pthread_mutex_lock(&_lock);
+        batch->failed = !ok;
+        batch->done = true;
+        pthread_cond_broadcast(&_written);
+        pthread_mutex_unlock(&_lock);
+    }
+
+    if (_tar)
+    {
+        // end of archive: two zero blocks.
+        uint8_t zero[1024];
+        std::memset(zero, 0, sizeof(zero));
+        append(zero, sizeof(zero));
+        flush();
+    }
+
+    return NULL;
+}
+
+
+// mkdir -p, relative to the output directory.  Directories are only created once.
+bool Writer::makeDirectory(const std::string& path)
+{
+    if (path.empty() || _directories.count(path)) return true;
+
+    std::string::size_type pos = path.rfind('/');
+    if (pos != std::string::npos && !makeDirectory(path.substr(0, pos))) return false;
+
+    if (::mkdirat(_fd, path.c_str(), 0777) < 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "%s/%s: %s\n", _output.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+
+    _directories.insert(path);
+    return true;
+}
+
+
+bool Writer::writeDirectory(Batch *batch)
+{
+    std::string dir = _output + "/" + batch->dir;
+
+    if (!makeDirectory(batch->dir)) return false;
+
+    int dfd = ::openat(_fd, batch->dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+
+    for (unsigned i = 0; i < batch->subdirs.size(); ++i)
+    {
+        if (::mkdirat(dfd, batch->subdirs[i].c_str(), 0777) < 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "%s/%s: %s\n", dir.c_str(), batch->subdirs[i].c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+
+    for (std::vector<Item>::iterator iter = batch->items.begin(); iter != batch->items.end(); ++iter)
+    {
+        int fd = ::openat(dfd, iter->name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0 || !WriteAll(fd, iter->data, iter->size))
+        {
+            fprintf(stderr, "%s/%s: %s\n", dir.c_str(), iter->name.c_str(), strerror(errno));
+            if (fd >= 0) ::close(fd);
+            ok = false;
+            continue;
+        }
+        ::close(fd);
+
+        stats.files += 1;
+        stats.bytes += iter->size;
+    }
+
+    int fd = ::openat(dfd, "index", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || !WriteAll(fd, (const uint8_t *)batch->index.data(), batch->index.size()))
+    {
+        fprintf(stderr, "%s/index: %s\n", dir.c_str(), strerror(errno));
+        ok = false;
+    }
+    if (fd >= 0) ::close(fd);
+
+    ::close(dfd);
+    return ok;
+}
+
+
+// once a write fails the archive is broken, and everything after it fails too.
+bool Writer::append(const void *data, unsigned size)
+{
+    if (_broken) return false;
+
+    const uint8_t *cp = (const uint8_t *)data;
+
+    // big bodies go straight out rather than through the buffer.
+    if (size >= _buffer.capacity() / 2)
+    {
+        if (!flush()) return false;
+        if (!WriteAll(_fd, cp, size))
+        {
+            fprintf(stderr, "%s: %s\n", _output.c_str(), strerror(errno));
+            _broken = true;
+        }
+        return !_broken;
+    }
+
+    if (_buffer.size() + size > _buffer.capacity() && !flush()) return false;
+    _buffer.insert(_buffer.end(), cp, cp + size);
+    return !_broken;
+}
+
+bool Writer::flush()
+{
+    if (_buffer.empty() || _broken) return !_broken;
+
+    if (!WriteAll(_fd, &_buffer[0], _buffer.size()))
+    {
+        fprintf(stderr, "%s: %s\n", _output.c_str(), strerror(errno));
+        _broken = true;
+    }
+
+    _buffer.clear();
+
+    if (!_broken)
+    {
+        stats.files += _pending.files;
+        stats.bytes += _pending.bytes;
+    }
+    _pending.files = 0;
+    _pending.bytes = 0;
+
+    return !_broken;
+}
+
+
+bool Writer::writeTarEntry(const std::string& name, const uint8_t *data, unsigned size)
+{
+    /*
+     * ustar header:
+     * 0 name[100], 100 mode[8], 108 uid[8], 116 gid[8], 124 size[12], 136 mtime[12],
+     * 148 chksum[8], 156 typeflag, 157 linkname[100], 257 magic[6], 263 version[2],
+     * 265 uname[32], 297 gname[32], 329 devmajor[8], 337 devminor[8], 345 prefix[155]
+     */
+
+    char header[512];
+    std::memset(header, 0, sizeof(header));
+
+    std::string prefix;
+    std::string base = name;
+
+    if (base.length() > 100)
+    {
+        std::string::size_type pos = name.find('/', name.length() > 101 ? name.length() - 101 : 0);
+        if (pos == std::string::npos || pos > 155)
+        {
+            fprintf(stderr, "%s: name too long for tar\n", name.c_str());
+            return false;
+        }
+        prefix = name.substr(0, pos);
+        base = name.substr(pos + 1);
+    }
+
+    std::memcpy(header, base.data(), base.length());
+    std::sprintf(header + 100, "%07o", 0644);
+    std::sprintf(header + 108, "%07o", 0);
+    std::sprintf(header + 116, "%07o", 0);
+    std::sprintf(header + 124, "%011o", size);
+    std::sprintf(header + 136, "%011o", 0);
+    header[156] = '0';
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+    std::memcpy(header + 345, prefix.data(), prefix.length());
+
+    std::memset(header + 148, ' ', 8);
+    unsigned sum = 0;
+    for (unsigned i = 0; i < 512; ++i) sum += (uint8_t)header[i];
+    std::sprintf(header + 148, "%06o", sum);
+
+    if (!append(header, 512) || !append(data, size)) return false;
+
+    if (size & 511)
+    {
+        static const uint8_t zero[512] = { 0 };
+        if (!append(zero, 512 - (size & 511))) return false;
+    }
+    return true;
+}
+
+bool Writer::writeTar(Batch *batch)
+{
+    bool ok = true;
+
+    for (std::vector<Item>::iterator iter = batch->items.begin(); iter != batch->items.end(); ++iter)
+    {
+        if (!writeTarEntry(batch->dir + "/" + iter->name, iter->data, iter->size))
+        {
+            ok = false;
+            continue;
+        }
+
+        _pending.files += 1;
+        _pending.bytes += iter->size;
+    }
+
+    if (!writeTarEntry(batch->dir + "/index", (const uint8_t *)batch->index.data(), batch->index.size()))
+        ok = false;
+
+    return ok;
+}
+
+
+static void *WriterThread(void *arg)
+{
+    return ((Writer *)arg)->run();
+}
+
+
+
+// output directory for a fork -- the path, made relative.
+static std::string ForkDirectory(const char *path)
+{
+    std::string s;
+
+    while (*path)
+    {
+        while (*path == '/') ++path;
+
+        const char *end = std::strchr(path, '/');
+        if (!end) end = path + std::strlen(path);
+
+        std::string component(path, end - path);
+        path = end;
+
+        if (component.empty() || component == "." || component == "..") continue;
+
+        if (!s.empty()) s.push_back('/');
+        s.append(component);
+    }
+
+    return s;
+}
+
+
+typedef std::pair<ResID, std::string> Name;
+
+static void Extract(const char *path, ResourceManager *rm, int error, void *context)
+{
+    Writer *writer = (Writer *)context;
+
+    if (!rm || rm->error())
+    {
+        if (rm) fprintf(stderr, "invalid resource file: ``%s''\n", path);
+        else fprintf(stderr, "%s: %s\n", path, strerror(error));
+
+        __sync_fetch_and_add(&writer->stats.failed, 1);
+        return;
+    }
+
+    Batch batch;
+    batch.dir = ForkDirectory(path);
+
+    unsigned count = rm->countResources();
+    unsigned types = rm->countTypes();
+
+    batch.items.reserve(count);
+    batch.subdirs.reserve(types);
+
+    for (unsigned i = 0; i < types; ++i)
+    {
+        char buffer[8];
+        std::sprintf(buffer, "%04x", rm->getIndexedType(i));
+        batch.subdirs.push_back(buffer);
+    }
+
+    std::vector<Name> names;
+
+    for (unsigned t = 0; t < types; ++t)
+    {
+        ResType resType = rm->getIndexedType(t);
+        RecordRange records = rm->resources(resType);
+
+        // both lists are sorted by id, so names are matched in a single pass.
+        names = rm->getResourceNames(resType);
+        std::vector<Name>::const_iterator name = names.begin();
+
+        for (RecordRange::iterator r = records.begin(); r != records.end(); ++r)
+        {
+            char buffer[64];
+
+            Item item;
+            std::sprintf(buffer, "%04x/%08x", r->resType, r->resID);
+            item.name = buffer;
+            item.data = rm->resourceData(*r);
+            item.size = r->resSize;
+            batch.items.push_back(item);
+
+            while (name != names.end() && name->first < r->resID) ++name;
+
+            std::sprintf(buffer, "%04x\t%08x\t%04x\t%08x\t", r->resType, r->resID, r->resAttr, r->resSize);
+            batch.index.append(buffer);
+            if (name != names.end() && name->first == r->resID) batch.index.append(name->second);
+            batch.index.push_back('\n');
+        }
+    }
+
+    // rm (and the fork data) is only valid until we return.
+    writer->write(&batch);
+
+    if (batch.failed) __sync_fetch_and_add(&writer->stats.failed, 1);
+    else __sync_fetch_and_add(&writer->stats.forks, 1);
+}
+
+
+
+void usage(int exitCode)
+{
+    FILE *fp = exitCode == 0 ? stdout : stderr;
+
+    fprintf(fp, "Usage: %s [-r | -d] [-j workers] [-q depth] (-o dir | -t file.tar) [-f list] file [...]\n", progname);
+    fprintf(fp, "  -r  files are raw resource forks\n");
+    fprintf(fp, "  -d  read forks from AppleDouble ._ files\n");
+    fprintf(fp, "  -j  parser threads (default: one per cpu)\n");
+    fprintf(fp, "  -q  reads in flight (default: 32)\n");
+    fprintf(fp, "  -o  extract into a directory\n");
+    fprintf(fp, "  -t  extract into a tar file\n");
+    fprintf(fp, "  -f  read file names from list (- for stdin), one per line\n");
+    exit(exitCode);
+}
+
+
+static void ReadList(const char *list, ForkLoader& loader)
+{
+    FILE *fp = std::strcmp(list, "-") ? fopen(list, "r") : stdin;
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", list, strerror(errno));
+        exit(1);
+    }
+
+    std::string line;
+    int c;
+
+    while ((c = fgetc(fp)) != EOF)
+    {
+        if (c == '\n')
+        {
+            if (!line.empty()) loader.add(line);
+            line.clear();
+        }
+        else line.push_back(c);
+    }
+    if (!line.empty()) loader.add(line);
+
+    if (fp != stdin) fclose(fp);
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned options = 0;
+    unsigned workers = 0;
+    unsigned depth = 32;
+    const char *output = NULL;
+    const char *list = NULL;
+    bool tar = false;
+    int c;
+
+    if (argc > 0) progname = argv[0];
+
+    while ((c = getopt(argc, argv, "rdj:q:o:t:f:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'r':
+                options |= rfRaw;
+                break;
+            case 'd':
+                options |= rfAppleDouble;
+                break;
+            case 'j':
+                workers = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                depth = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                output = optarg;
+                tar = false;
+                break;
+            case 't':
+                output = optarg;
+                tar = true;
+                break;
+            case 'f':
+                list = optarg;
+                break;
+            case 'h':
+                usage(0);
+                break;
+            default:
+                usage(1);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (!output || (argc == 0 && !list)) usage(1);
+
+    ForkLoader loader(options, depth, workers);
+
+    if (list) ReadList(list, loader);
+    for (int i = 0; i < argc; ++i) loader.add(argv[i]);
+
+    Writer writer(output, tar);
+    if (!writer.ok()) exit(1);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, WriterThread, &writer) != 0)
+    {
+        fprintf(stderr, "%s: unable to create writer thread\n", progname);
+        exit(1);
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    loader.run(Extract, &writer);
+
+    writer.finish();
+    pthread_join(thread, NULL);
+
+    gettimeofday(&end, NULL);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    if (seconds <= 0) seconds = 0.000001;
+
+    const Stats& s = writer.stats;
+
+    fprintf(stderr, "%u forks (%u failed), %u resources, %llu bytes in %.3f s\n",
+        s.forks, s.failed, s.files, (unsigned long long)s.bytes, seconds);
+    fprintf(stderr, "%.1f forks/s, %.1f files/s, %.2f MB/s\n",
+        s.forks / seconds, s.files / seconds, s.bytes / seconds / (1024.0 * 1024.0));
+
+    // the final flush can fail after every fork was counted.
+    if (writer.broken()) fprintf(stderr, "%s: %s is incomplete\n", progname, output);
+
+    exit(s.failed || writer.broken() ? 1 : 0);
+}
@@ -0,0 +1,433 @@
+/*
+ *  rsrcd.cpp
+ *  IIgsResource
+ *
+ *  Resource index daemon.  Forks are read and indexed once and published
+ *  in a shared memory segment (see ResourceClient.h), which clients map
+ *  read-only.  The unix socket is only used to attach forks that aren't
+ *  in the segment yet.
+ *
+ *  The segment is append-only -- forks are never reloaded or removed, so
+ *  restart rsrcd if they change on disk.
+ */
+
+#include "ResourceManager.h"
+#include "ResourceClient.h"
+#include "ResourceFork.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <set>
+#include <string>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+using namespace IIgs;
+
+static const char *progname = "rsrcd";
+
+static volatile sig_atomic_t done = 0;
+
+
+class Segment {
+
+public:
+
+    Segment(const char *name, unsigned capacity, mode_t mode, unsigned options);
+    ~Segment();
+
+    bool ok() const { return _header != NULL; }
+
+    // returns 0 or an error code.
+    unsigned attach(const std::string& path);
+
+    unsigned count() const { return _header->count; }
+    unsigned used() const { return _header->used; }
+
+private:
+
+    uint8_t *allocate(unsigned size);
+
+    std::string _name;
+    SharedIndexHeader *_header;
+    unsigned _capacity;
+    unsigned _options;
+
+    std::set<std::string> _paths;
+};
+
+
+Segment::Segment(const char *name, unsigned capacity, mode_t mode, unsigned options)
+{
+    _name = name;
+    _header = NULL;
+    _capacity = capacity;
+    _options = options;
+
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, mode);
+    if (fd >= 0) fchmod(fd, mode);      // not subject to the umask.
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+        return;
+    }
+
+    // pages are only allocated as they're used.
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, capacity) == 0)
+        p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+        ::close(fd);
+        shm_unlink(name);
+        return;
+    }
+    ::close(fd);
+
+    SharedIndexHeader *h = (SharedIndexHeader *)p;
+
+    std::memset(h, 0, sizeof(SharedIndexHeader));
+    h->version = SharedIndexVersion;
+    h->recordSize = sizeof(ResourceRecord);
+    h->capacity = capacity;
+    h->used = (sizeof(SharedIndexHeader) + 7) & ~7;
+    h->count = 0;
+
+    __sync_synchronize();
+    h->magic = SharedIndexMagic;
+
+    _header = h;
+}
+
+Segment::~Segment()
+{
+    if (_header)
+    {
+        munmap(_header, _capacity);
+        shm_unlink(_name.c_str());
+    }
+}
+
+
+uint8_t *Segment::allocate(unsigned size)
+{
+    unsigned used = _header->used;
+
+    size = (size + 7) & ~7;
+    if (size > _capacity - used) return NULL;
+
+    _header->used = used + size;
+    return (uint8_t *)_header + used;
+}
+
+
+unsigned Segment::attach(const std::string& path)
+{
+    if (_paths.find(path) != _paths.end()) return 0;
+
+    unsigned length;
+    uint8_t *data = ReadResourceFork(path.c_str(), &length, _options);
+    if (!data) return resFileNotFound;
+
+    ResourceManager rm(data, length, rmDelete);
+    if (rm.error()) return rm.error();
+
+    RecordRange records = rm.resources();
+    TypeRange types = rm.types();
+
+    // don't leave a partial entry behind if the segment fills up.
+    unsigned mark = _header->used;
+
+    uint8_t *forkData = allocate(length);
+    uint8_t *recordData = allocate(records.size() * sizeof(ResourceRecord));
+    uint8_t *typeData = allocate(types.size() * sizeof(ResType));
+    SharedFork *f = (SharedFork *)allocate(sizeof(SharedFork) + path.length());
+
+    if (!forkData || !recordData || !typeData || !f)
+    {
+        _header->used = mark;
+        return resDiskFull;
+    }
+
+    std::memcpy(forkData, data, length);
+    if (!records.empty()) std::memcpy(recordData, records.begin(), records.size() * sizeof(ResourceRecord));
+    if (!types.empty()) std::memcpy(typeData, types.begin(), types.size() * sizeof(ResType));
+
+    const uint8_t *base = (const uint8_t *)_header;
+
+    f->hash = SharedIndexHash(path.data(), path.length());
+    f->dataOffset = forkData - base;
+    f->length = length;
+    f->recordOffset = recordData - base;
+    f->recordCount = records.size();
+    f->typeOffset = typeData - base;
+    f->typeCount = types.size();
+    f->pathLength = path.length();
+    std::memcpy(f->path, path.c_str(), path.length() + 1);
+
+    uint32_t *bucket = _header->buckets + (f->hash % SharedIndexBuckets);
+    f->next = *bucket;
+
+    // everything above must be visible before the entry is.
+    __sync_synchronize();
+    *bucket = (uint8_t *)f - base;
+    _header->count++;
+
+    _paths.insert(path);
+    return 0;
+}
+
+
+
+static void Attach(Segment& segment, const std::string& path, bool verbose)
+{
+    unsigned error = segment.attach(path);
+
+    if (error) fprintf(stderr, "%s: %s: error $%04x\n", progname, path.c_str(), error);
+    else if (verbose) fprintf(stderr, "%s: %s\n", progname, path.c_str());
+}
+
+
+static void ReadList(const char *list, Segment& segment, bool verbose)
+{
+    FILE *fp = std::strcmp(list, "-") ? fopen(list, "r") : stdin;
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", list, strerror(errno));
+        exit(1);
+    }
+
+    std::string line;
+    int c;
+
+    while ((c = fgetc(fp)) != EOF)
+    {
+        if (c == '\n')
+        {
+            if (!line.empty()) Attach(segment, SharedIndexKey(line.c_str()), verbose);
+            line.clear();
+        }
+        else line.push_back(c);
+    }
+    if (!line.empty()) Attach(segment, SharedIndexKey(line.c_str()), verbose);
+
+    if (fp != stdin) fclose(fp);
+}
+
+
+/*
+ * request: uint32_t length, path
+ * reply:   uint32_t error
+ */
+static void Serve(int fd, Segment& segment, bool verbose)
+{
+    uint32_t length;
+    uint32_t error = resFileNotFound;
+
+    if (!ReadAll(fd, &length, sizeof(length))) return;
+
+    if (length && length < PATH_MAX)
+    {
+        std::string path(length, 0);
+
+        if (!ReadAll(fd, &path[0], length)) return;
+
+        if (path[0] == '/' && path.find((char)0) == std::string::npos)
+        {
+            error = segment.attach(path);
+
+            if (error) fprintf(stderr, "%s: %s: error $%04x\n", progname, path.c_str(), error);
+            else if (verbose) fprintf(stderr, "%s: %s\n", progname, path.c_str());
+        }
+    }
+
+    while (::write(fd, &error, sizeof(error)) < 0 && errno == EINTR) ;
+}
+
+
+static bool Running(const struct sockaddr_un& addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    bool rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == 0;
+    ::close(fd);
+    return rv;
+}
+
+
+static void Stop(int)
+{
+    done = 1;
+}
+
+
+
+void usage(int exitCode)
+{
+    FILE *fp = exitCode == 0 ? stdout : stderr;
+
+    fprintf(fp, "Usage: %s [-r | -d] [-v] [-m megabytes] [-p mode] [-s segment] [-S socket] [-f list] [file ...]\n", progname);
+    fprintf(fp, "  -r  files are raw resource forks\n");
+    fprintf(fp, "  -d  read forks from AppleDouble ._ files\n");
+    fprintf(fp, "  -v  log each fork as it's attached\n");
+    fprintf(fp, "  -m  segment size (default: 256)\n");
+    fprintf(fp, "  -p  segment and socket permissions, octal (default: 600)\n");
+    fprintf(fp, "  -s  shared memory segment (default: %s)\n", SharedIndexSegment);
+    fprintf(fp, "  -S  unix socket (default: %s)\n", SharedIndexSocket);
+    fprintf(fp, "  -f  attach the files named in list (- for stdin), one per line\n");
+    exit(exitCode);
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned options = 0;
+    unsigned megabytes = 256;
+    mode_t mode = 0600;
+    const char *segmentName = SharedIndexSegment;
+    const char *socketName = SharedIndexSocket;
+    const char *list = NULL;
+    bool verbose = false;
+    int c;
+
+    if (argc > 0) progname = argv[0];
+
+    while ((c = getopt(argc, argv, "rdvm:p:s:S:f:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'r':
+                options |= rfRaw;
+                break;
+            case 'd':
+                options |= rfAppleDouble;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'm':
+                megabytes = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                mode = std::strtoul(optarg, NULL, 8) & 0777;
+                break;
+            case 's':
+                segmentName = optarg;
+                break;
+            case 'S':
+                socketName = optarg;
+                break;
+            case 'f':
+                list = optarg;
+                break;
+            case 'h':
+                usage(0);
+                break;
+            default:
+                usage(1);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    // offsets in the segment are 32-bit.
+    if (megabytes == 0 || megabytes >= 4096) usage(1);
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (std::strlen(socketName) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: %s: socket name too long\n", progname, socketName);
+        exit(1);
+    }
+    std::strcpy(addr.sun_path, socketName);
+
+
+    // the segment and socket are replaced below -- don't take them from a live rsrcd.
+    if (Running(addr))
+    {
+        fprintf(stderr, "%s: %s: already running\n", progname, socketName);
+        exit(1);
+    }
+
+    // the socket first, so a failure here doesn't leave a segment behind.
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    unlink(socketName);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || chmod(socketName, mode) < 0 || listen(listener, 16) < 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", progname, socketName, strerror(errno));
+        if (listener >= 0) unlink(socketName);
+        exit(1);
+    }
+
+    Segment segment(segmentName, megabytes << 20, mode, options);
+    if (!segment.ok())
+    {
+        ::close(listener);
+        unlink(socketName);
+        exit(1);
+    }
+
+    // clients connecting meanwhile just wait in the backlog.
+    if (list) ReadList(list, segment, verbose);
+    for (int i = 0; i < argc; ++i) Attach(segment, SharedIndexKey(argv[i]), verbose);
+
+
+    // no SA_RESTART, so accept() returns when we're asked to stop.
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (verbose) fprintf(stderr, "%s: %u forks, %u bytes\n", progname, segment.count(), segment.used());
+
+    while (!done)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+
+        // requests are served one at a time, so a client that stalls can't hold up the rest.
+        struct timeval tv;
+        tv.tv_sec = SharedIndexTimeout;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        Serve(fd, segment, verbose);
+        ::close(fd);
+    }
+
+    ::close(listener);
+    unlink(socketName);
+
+    if (verbose) fprintf(stderr, "%s: %u forks, %u bytes\n", progname, segment.count(), segment.used());
+
+    return 0;
+}